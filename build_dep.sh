@@ -2,7 +2,7 @@
 
 BLDDIR=`pwd`
 CPPC=g++
-CFLAGS="-g -O -I$BLDDIR/hfa"
+CFLAGS="--std=c++17 -g -O -I$BLDDIR/hfa"
 
 LINK=g++
 XTRALIBS="-lm -lpthread"
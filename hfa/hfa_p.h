@@ -119,6 +119,12 @@
 #include "cpl_vsi.h"
 #endif
 
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #ifdef CPL_LSB
 #  define HFAStandard(n,p)	{}
 #else
@@ -126,10 +132,12 @@
 #endif
 
 class HFAEntry;
+class HFAEntryPool;
 class HFAType;
 class HFADictionary;
 class HFABand;
 class HFASpillFile;
+class HFAFieldPath;
 
 /************************************************************************/
 /*      Flag indicating read/write, or read-only access to data.        */
@@ -163,6 +171,10 @@ typedef struct hfainfo {
 
     int         bTreeDirty;
     HFAEntry	*poRoot;
+    HFAEntryPool *poEntryPool;  /* owns every HFAEntry of the file */
+
+    GByte	*pabyMap;     /* whole file, if opened with "rm" access */
+    vsi_l_offset nMapSize;
 
     HFADictionary *poDictionary;
     char	*pszDictionary;
@@ -264,59 +276,115 @@ class HFABand
 };
 
 
+/************************************************************************/
+/*                             HFAEntryPool                             */
+/*                                                                      */
+/*      Per file storage for the HFAEntry tree.  Entries are carved     */
+/*      out of large blocks in the order they are read, and refer to    */
+/*      each other by 32 bit index (0 being no entry).  Entry names     */
+/*      and types are interned, as most of them repeat.  All entries    */
+/*      are destroyed together with the pool in HFAClose().             */
+/************************************************************************/
+
+#define HFA_ENTRY_BLOCK_SHIFT	10
+#define HFA_ENTRY_BLOCK_SIZE	(1 << HFA_ENTRY_BLOCK_SHIFT)
+
+class HFAEntryPool
+{
+    std::vector<GByte *> apabyBlocks;
+    GUInt32	nEntries;	/* including the unused entry 0 */
+
+    std::vector<const char *> apszStrings;
+    std::unordered_map<std::string, GUInt32> oStringIndex;
+
+    /* resolved dictionary type of each interned type name, by id */
+    std::vector<HFAType *> apoTypes;
+
+public:
+    		HFAEntryPool();
+    		~HFAEntryPool();
+
+    void	*Allocate( GUInt32 *pnIndex );
+    HFAEntry	*GetEntry( GUInt32 nIndex );
+
+    GUInt32	Intern( const char *pszString, size_t nMaxLen );
+    const char	*GetString( GUInt32 nId ) { return apszStrings[nId]; }
+
+    HFAType	*FindType( GUInt32 nTypeId, HFADictionary *poDictionary );
+};
+
 /************************************************************************/
 /*                               HFAEntry                               */
 /*                                                                      */
 /*      Base class for all entry types.  Most entry types do not        */
 /*      have a subclass, and are just handled generically with this     */
-/*      class.                                                          */
+/*      class.  Entries live in the file's HFAEntryPool and are         */
+/*      created with HFAEntry::New(), never with new or delete.         */
 /************************************************************************/
 class HFAEntry
 {
-    int         bDirty;
-    GUInt32	nFilePos;
-    
     HFAInfo_t	*psHFA;
-    HFAEntry	*poParent;
-    HFAEntry	*poPrev;
+    GUInt32	nFilePos;
+    GUInt32	nIndex;		/* of this entry in psHFA->poEntryPool */
+
+    GUInt32	nParent;	/* pool indices, 0 if none */
+    GUInt32	nPrev;
+    GUInt32	nNext;
+    GUInt32	nChild;
 
     GUInt32	nNextPos;
-    HFAEntry	*poNext;
-    
     GUInt32	nChildPos;
-    HFAEntry	*poChild;
-
-    char	szName[64];
-    char	szType[32];
 
-    HFAType	*poType;
+    GUInt32	nNameId;	/* interned in psHFA->poEntryPool */
+    GUInt32	nTypeId;
 
     GUInt32	nDataPos;
     GUInt32	nDataSize;
+
+    HFAType	*poType;
     GByte	*pabyData;
 
+    GByte	bDirty;
+    GByte	bDataMapped;  /* pabyData points into psHFA->pabyMap */
+
+    		HFAEntry( HFAInfo_t * psHFA, GUInt32 nIndex, GUInt32 nPos,
+                          HFAEntry * poParent, HFAEntry *poPrev);
+
+                HFAEntry( HFAInfo_t *psHFA, GUInt32 nIndex,
+                          const char *pszNodeName,
+                          const char *pszTypeName,
+                          HFAEntry * poParent );
+
+    HFAEntry	*Entry( GUInt32 nEntry )
+        { return psHFA->poEntryPool->GetEntry( nEntry ); }
+
+    void        DetachData();
+
     //void	LoadData();
 
     int 	GetFieldValue( const char *, char, void * );
+    int 	GetFieldValue( HFAFieldPath *, char, void * );
     CPLErr      SetFieldValue( const char *, char, void * );
 
+    friend class HFAEntryPool;
+
 public:
-    		HFAEntry( HFAInfo_t * psHFA, GUInt32 nPos,
-                          HFAEntry * poParent, HFAEntry *poPrev);
+    static HFAEntry *New( HFAInfo_t * psHFA, GUInt32 nPos,
+                          HFAEntry * poParent, HFAEntry *poPrev );
 
-                HFAEntry( HFAInfo_t *psHFA, 
+    static HFAEntry *New( HFAInfo_t *psHFA,
                           const char *pszNodeName,
                           const char *pszTypeName,
                           HFAEntry *poParent );
-                          
-    virtual     ~HFAEntry();                
-    
+
+                ~HFAEntry();
+
     GUInt32	GetFilePos() { return nFilePos; }
 
-    const char	*GetName() { return szName; }
+    const char	*GetName() { return psHFA->poEntryPool->GetString(nNameId); }
     void SetName( const char *pszNodeName );
     
-    const char  *GetType() { return szType; }
+    const char  *GetType() { return psHFA->poEntryPool->GetString(nTypeId); }
     HFAType	*GetPoType() { return poType; }	
 
     GUInt32	GetDataPos() { return nDataPos; }
@@ -329,6 +397,11 @@ public:
     GInt32	GetIntField( const char *, CPLErr * = NULL );
     double	GetDoubleField( const char *, CPLErr * = NULL );
     const char	*GetStringField( const char *, CPLErr * = NULL );
+
+    HFAFieldPath *GetFieldPath( const char * );
+    GInt32	GetIntField( HFAFieldPath *, CPLErr * = NULL );
+    double	GetDoubleField( HFAFieldPath *, CPLErr * = NULL );
+    const char	*GetStringField( HFAFieldPath *, CPLErr * = NULL );
     GIntBig     GetBigIntField( const char *, CPLErr * = NULL );
     int         GetFieldCount( const char *, CPLErr * = NULL );
 
@@ -337,6 +410,7 @@ public:
     CPLErr      SetStringField( const char *, const char * );
 
     void	LoadData();
+    void	ReleaseData();
     GByte	*GetData(){ return pabyData; };
 
     void	DumpFieldValues( FILE *, const char * = NULL );
@@ -348,6 +422,20 @@ public:
     GByte      *MakeData( int nSize = 0 );
 };
 
+/************************************************************************/
+/*                       HFAEntryPool::GetEntry()                       */
+/************************************************************************/
+
+inline HFAEntry *HFAEntryPool::GetEntry( GUInt32 nIndex )
+
+{
+    if( nIndex == 0 )
+        return NULL;
+
+    return ((HFAEntry *) apabyBlocks[nIndex >> HFA_ENTRY_BLOCK_SHIFT])
+        + (nIndex & (HFA_ENTRY_BLOCK_SIZE - 1));
+}
+
 /************************************************************************/
 /*                               HFAField                               */
 /*                                                                      */
@@ -382,6 +470,9 @@ class HFAField
     int 	ExtractInstValue( const char * pszField, int nIndexValue,
                      GByte *pabyData, GUInt32 nDataOffset, int nDataSize,
                      char chReqType, void *pReqReturn );
+    int		ExtractBaseData( GByte *pabyData, int nDataSize,
+                                 int *pnRows, int *pnColumns,
+                                 double *padfValues, int nMaxValues );
 
     CPLErr      SetInstValue( const char * pszField, int nIndexValue,
                      GByte *pabyData, GUInt32 nDataOffset, int nDataSize,
@@ -405,6 +496,12 @@ class HFAField
 
 class HFAType
 {
+    /* compiled on first use; types are shared between handles (and
+       threads) through the dictionary cache, so each type guards its
+       own paths, and lookups of compiled paths only share the lock */
+    std::map<std::string, HFAFieldPath *> oFieldPaths;
+    std::shared_mutex oFieldPathLock;
+
   public:
     int		nBytes;
     
@@ -434,6 +531,40 @@ class HFAType
     void	DumpInstValue( FILE *fpOut, 
                            GByte *pabyData, GUInt32 nDataOffset, int nDataSize,
                            const char *pszPrefix = NULL );
+
+    HFAFieldPath *GetFieldPath( const char * pszFieldPath );
+};
+
+/************************************************************************/
+/*                             HFAFieldPath                             */
+/*                                                                      */
+/*      A field path (as accepted by HFAType::ExtractInstValue())       */
+/*      resolved against one HFAType.  Each step records the field      */
+/*      and array index; where everything ahead of a field is fixed     */
+/*      size its byte offset is precomputed, so extraction does no      */
+/*      parsing or field name comparison.  Obtain these from            */
+/*      HFAType::GetFieldPath(), which owns and caches them.            */
+/************************************************************************/
+
+class HFAFieldPath
+{
+  public:
+    HFAType	*poType;
+
+    int		nSteps;
+    HFAType	**papoStepTypes;   /* type containing each step's field */
+    int		*panStepField;     /* field index within that type */
+    int		*panStepOffset;    /* field byte offset, or -1 if variable */
+    int		*panStepIndex;     /* array index */
+
+    		HFAFieldPath();
+                ~HFAFieldPath();
+
+    static HFAFieldPath *Compile( HFAType *, const char * pszFieldPath );
+
+    int         ExtractInstValue( GByte *pabyData, GUInt32 nDataOffset,
+                                  int nDataSize,
+                                  char chReqType, void *pReqReturn );
 };
 
 /************************************************************************/
@@ -446,10 +577,19 @@ class HFADictionary
     int		nTypes;
     int         nTypesMax;
     HFAType	**papoTypes;
+
+    /* hashed index of papoTypes by type name, first definition wins */
+    std::unordered_map<std::string, HFAType *> oTypeIndex;
+
+    /* handles sharing this dictionary, see Acquire() */
+    int		nRefCount;
     
     		HFADictionary( const char * );
                 ~HFADictionary();
 
+    static HFADictionary *Acquire( const char * );
+    static void	Release( HFADictionary * );
+
     HFAType	*FindType( const char * );
     void        AddType( HFAType * );
 
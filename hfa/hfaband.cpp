@@ -1505,8 +1505,8 @@ CPLErr HFABand::SetPCT( int nColors,
     {
         HFAEntry	*poEdsc_Table;
 
-        poEdsc_Table = new HFAEntry( psInfo, "Descriptor_Table", "Edsc_Table",
-                                     poNode );
+        poEdsc_Table = HFAEntry::New( psInfo, "Descriptor_Table", "Edsc_Table",
+                                      poNode );
 
         poEdsc_Table->SetIntField( "numrows", nColors );
 
@@ -1517,8 +1517,8 @@ CPLErr HFABand::SetPCT( int nColors,
         HFAEntry       *poEdsc_BinFunction;
 
         poEdsc_BinFunction = 
-            new HFAEntry( psInfo, "#Bin_Function#", "Edsc_BinFunction",
-                          poEdsc_Table );
+            HFAEntry::New( psInfo, "#Bin_Function#", "Edsc_BinFunction",
+                           poEdsc_Table );
 
         // Because of the BaseData we have to hardcode the size. 
         poEdsc_BinFunction->MakeData( 30 );
@@ -1561,8 +1561,8 @@ CPLErr HFABand::SetPCT( int nColors,
 /* -------------------------------------------------------------------- */
 /*      Create the Edsc_Column.                                         */
 /* -------------------------------------------------------------------- */
-            poEdsc_Column = new HFAEntry( psInfo, pszName, "Edsc_Column", 
-                                          poEdsc_Table );
+            poEdsc_Column = HFAEntry::New( psInfo, pszName, "Edsc_Column", 
+                                           poEdsc_Table );
             poEdsc_Column->SetIntField( "numRows", nColors );
             poEdsc_Column->SetStringField( "dataType", "real" );
             poEdsc_Column->SetIntField( "maxNumChars", 0 );
@@ -1654,8 +1654,8 @@ int HFABand::CreateOverview( int nOverviewLevel )
         if( poParent == NULL )
         {
             poParent = 
-                new HFAEntry( psRRDInfo, poNode->GetName(), 
-                              "Eimg_Layer", psRRDInfo->poRoot );
+                HFAEntry::New( psRRDInfo, poNode->GetName(), 
+                               "Eimg_Layer", psRRDInfo->poRoot );
         }
     }
 
@@ -1680,9 +1680,9 @@ int HFABand::CreateOverview( int nOverviewLevel )
     HFAEntry *poRRDNamesList = poNode->GetNamedChild("RRDNamesList");
     if( poRRDNamesList == NULL )
     {
-        poRRDNamesList = new HFAEntry( psInfo, "RRDNamesList", 
-                                       "Eimg_RRDNamesList", 
-                                       poNode );
+        poRRDNamesList = HFAEntry::New( psInfo, "RRDNamesList", 
+                                        "Eimg_RRDNamesList", 
+                                        poNode );
         poRRDNamesList->MakeData( 23+16+8+ 3000 /* hack for growth room*/ );
 
         /* we need to hardcode file offset into the data, so locate it now */
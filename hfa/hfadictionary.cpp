@@ -59,6 +59,8 @@
 #include "hfa_p.h"
 #include "cpl_conv.h"
 
+#include <mutex>
+
 CPL_CVSID("$Id: hfadictionary.cpp,v 1.8 2005/09/27 18:01:37 fwarmerdam Exp $");
 
 static char *apszDefDefn[] = {
@@ -92,6 +94,17 @@ static char *apszDefDefn[] = {
     
     NULL,
     NULL };
+
+/* -------------------------------------------------------------------- */
+/*      Process wide cache of parsed dictionaries, keyed by the         */
+/*      dictionary text.  Cached dictionaries are immutable and are     */
+/*      shared by every handle opened on a file carrying the same       */
+/*      dictionary.  The cache holds one reference on each entry.       */
+/* -------------------------------------------------------------------- */
+#define HFA_DICT_CACHE_MAX 16
+
+static std::mutex oDictCacheMutex;
+static std::unordered_map<std::string, HFADictionary *> oDictCache;
     
     
 
@@ -114,6 +127,7 @@ HFADictionary::HFADictionary( const char * pszString )
     nTypes = 0;
     nTypesMax = 0;
     papoTypes = NULL;
+    nRefCount = 1;
 
 /* -------------------------------------------------------------------- */
 /*      Read all the types.                                             */
@@ -172,6 +186,78 @@ HFADictionary::~HFADictionary()
     CPLFree( papoTypes );
 }
 
+/************************************************************************/
+/*                              Acquire()                               */
+/*                                                                      */
+/*      Return a parsed dictionary for the given dictionary text,       */
+/*      reusing a cached one if the same text has been seen before.     */
+/*      The result must be released with Release(), never deleted.      */
+/************************************************************************/
+
+HFADictionary *HFADictionary::Acquire( const char * pszDictionary )
+
+{
+    std::string osKey( pszDictionary );
+
+    {
+        std::lock_guard<std::mutex> oLock( oDictCacheMutex );
+        std::unordered_map<std::string, HFADictionary *>::iterator oIter;
+
+        oIter = oDictCache.find( osKey );
+        if( oIter != oDictCache.end() )
+        {
+            oIter->second->nRefCount++;
+            return oIter->second;
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Parse outside the lock, then publish unless another thread      */
+/*      beat us to it.                                                  */
+/* -------------------------------------------------------------------- */
+    HFADictionary *poDict = new HFADictionary( pszDictionary );
+
+    std::lock_guard<std::mutex> oLock( oDictCacheMutex );
+    std::unordered_map<std::string, HFADictionary *>::iterator oIter;
+
+    oIter = oDictCache.find( osKey );
+    if( oIter != oDictCache.end() )
+    {
+        delete poDict;
+        oIter->second->nRefCount++;
+        return oIter->second;
+    }
+
+    if( oDictCache.size() < HFA_DICT_CACHE_MAX )
+    {
+        poDict->nRefCount++;
+        oDictCache[osKey] = poDict;
+    }
+
+    return poDict;
+}
+
+/************************************************************************/
+/*                              Release()                               */
+/************************************************************************/
+
+void HFADictionary::Release( HFADictionary *poDict )
+
+{
+    if( poDict == NULL )
+        return;
+
+    int		nRemaining;
+
+    {
+        std::lock_guard<std::mutex> oLock( oDictCacheMutex );
+        nRemaining = --poDict->nRefCount;
+    }
+
+    if( nRemaining == 0 )
+        delete poDict;
+}
+
 /************************************************************************/
 /*                              AddType()                               */
 /************************************************************************/
@@ -187,24 +273,29 @@ void HFADictionary::AddType( HFAType *poType )
     }
 
     papoTypes[nTypes++] = poType;
+
+    if( poType->pszTypeName != NULL )
+        oTypeIndex.insert( std::make_pair( std::string(poType->pszTypeName),
+                                           poType ) );
 }
 
 /************************************************************************/
 /*                              FindType()                              */
+/*                                                                      */
+/*      Lookup a type by name in the hashed index maintained by         */
+/*      AddType().                                                      */
 /************************************************************************/
 
 HFAType * HFADictionary::FindType( const char * pszName )
 
 {
-    int		i;
+    std::unordered_map<std::string, HFAType *>::const_iterator oIter;
 
-    for( i = 0; i < nTypes; i++ )
-    {
-        if( strcmp(pszName,papoTypes[i]->pszTypeName) == 0 )
-            return( papoTypes[i] );
-    }
+    oIter = oTypeIndex.find( pszName );
+    if( oIter == oTypeIndex.end() )
+        return NULL;
 
-    return NULL;
+    return oIter->second;
 }
 
 /************************************************************************/
@@ -84,48 +84,217 @@
 #include "hfa_p.h"
 #include "cpl_conv.h"
 
+#include <new>
+
 CPL_CVSID("$Id: hfaentry.cpp,v 1.14 2006/05/07 04:04:03 fwarmerdam Exp $");
 
+/************************************************************************/
+/* ==================================================================== */
+/*      		       HFAEntryPool                             */
+/* ==================================================================== */
+/************************************************************************/
+
+/************************************************************************/
+/*                            HFAEntryPool()                            */
+/************************************************************************/
+
+HFAEntryPool::HFAEntryPool()
+
+{
+    nEntries = 1; /* index 0 stands for no entry */
+
+    Intern( "", 0 );
+}
+
+/************************************************************************/
+/*                           ~HFAEntryPool()                            */
+/*                                                                      */
+/*      Destroy every entry handed out, then release the blocks.        */
+/************************************************************************/
+
+HFAEntryPool::~HFAEntryPool()
+
+{
+    GUInt32	i;
+
+    for( i = 1; i < nEntries; i++ )
+        GetEntry( i )->~HFAEntry();
+
+    for( i = 0; i < apabyBlocks.size(); i++ )
+        CPLFree( apabyBlocks[i] );
+}
+
+/************************************************************************/
+/*                              Allocate()                              */
+/*                                                                      */
+/*      Return uninitialized storage for one more entry, and its        */
+/*      index.                                                          */
+/************************************************************************/
+
+void *HFAEntryPool::Allocate( GUInt32 *pnIndex )
+
+{
+    if( (nEntries >> HFA_ENTRY_BLOCK_SHIFT) == apabyBlocks.size() )
+        apabyBlocks.push_back( (GByte *)
+            CPLMalloc( sizeof(HFAEntry) * HFA_ENTRY_BLOCK_SIZE ) );
+
+    *pnIndex = nEntries++;
+
+    return GetEntry( *pnIndex );
+}
+
+/************************************************************************/
+/*                               Intern()                               */
+/*                                                                      */
+/*      Return the id of a string of at most nMaxLen characters (0      */
+/*      for no limit), adding it the first time it is seen.             */
+/************************************************************************/
+
+GUInt32 HFAEntryPool::Intern( const char *pszString, size_t nMaxLen )
+
+{
+    size_t	nLen = 0;
+
+    while( (nMaxLen == 0 || nLen < nMaxLen) && pszString[nLen] != '\0' )
+        nLen++;
+
+    std::pair<std::unordered_map<std::string, GUInt32>::iterator, bool> oRes =
+        oStringIndex.insert( std::make_pair( std::string( pszString, nLen ),
+                                             (GUInt32) apszStrings.size() ) );
+
+    /* map keys never move, so they can be handed out directly */
+    if( oRes.second )
+        apszStrings.push_back( oRes.first->first.c_str() );
+
+    return oRes.first->second;
+}
+
+/************************************************************************/
+/*                              FindType()                              */
+/*                                                                      */
+/*      Return the dictionary type of an interned type name.  Each      */
+/*      distinct type is looked up in the dictionary only once, the     */
+/*      result is then kept by type id.                                 */
+/************************************************************************/
+
+HFAType *HFAEntryPool::FindType( GUInt32 nTypeId,
+                                 HFADictionary *poDictionary )
+
+{
+    if( nTypeId < apoTypes.size() && apoTypes[nTypeId] != NULL )
+        return apoTypes[nTypeId];
+
+    HFAType *poType = poDictionary->FindType( GetString( nTypeId ) );
+
+    /* unknown types are not kept, they are rare */
+    if( poType != NULL )
+    {
+        if( nTypeId >= apoTypes.size() )
+            apoTypes.resize( nTypeId + 1, NULL );
+        apoTypes[nTypeId] = poType;
+    }
+
+    return poType;
+}
+
+/************************************************************************/
+/* ==================================================================== */
+/*      		         HFAEntry                               */
+/* ==================================================================== */
+/************************************************************************/
+
+/************************************************************************/
+/*                                New()                                 */
+/*                                                                      */
+/*      Create an entry in the file's pool.                             */
+/************************************************************************/
+
+HFAEntry *HFAEntry::New( HFAInfo_t * psHFA, GUInt32 nPos,
+                         HFAEntry * poParent, HFAEntry * poPrev )
+
+{
+    GUInt32	nIndex;
+
+    if( psHFA->poEntryPool == NULL )
+        psHFA->poEntryPool = new HFAEntryPool();
+
+    void *pStorage = psHFA->poEntryPool->Allocate( &nIndex );
+
+    return new (pStorage) HFAEntry( psHFA, nIndex, nPos, poParent, poPrev );
+}
+
+HFAEntry *HFAEntry::New( HFAInfo_t * psHFA,
+                         const char * pszNodeName,
+                         const char * pszTypeName,
+                         HFAEntry * poParent )
+
+{
+    GUInt32	nIndex;
+
+    if( psHFA->poEntryPool == NULL )
+        psHFA->poEntryPool = new HFAEntryPool();
+
+    void *pStorage = psHFA->poEntryPool->Allocate( &nIndex );
+
+    return new (pStorage) HFAEntry( psHFA, nIndex, pszNodeName, pszTypeName,
+                                    poParent );
+}
+
 /************************************************************************/
 /*                              HFAEntry()                              */
 /*                                                                      */
 /*      Construct an HFAEntry from the source file.                     */
 /************************************************************************/
 
-HFAEntry::HFAEntry( HFAInfo_t * psHFAIn, GUInt32 nPos,
+HFAEntry::HFAEntry( HFAInfo_t * psHFAIn, GUInt32 nIndexIn, GUInt32 nPos,
                     HFAEntry * poParentIn, HFAEntry * poPrevIn )
 
 {
     psHFA = psHFAIn;
+    nIndex = nIndexIn;
     
     nFilePos = nPos;
     bDirty = FALSE;
 
-    poParent = poParentIn;
-    poPrev = poPrevIn;
+    nParent = (poParentIn != NULL) ? poParentIn->nIndex : 0;
+    nPrev = (poPrevIn != NULL) ? poPrevIn->nIndex : 0;
 
 /* -------------------------------------------------------------------- */
 /*      Initialize fields to null values in case there is a read        */
 /*      error, so the entry will be in a harmless state.                */
 /* -------------------------------------------------------------------- */
-    poNext = poChild = NULL;
+    nNext = nChild = 0;
 
     nDataPos = nDataSize = 0;
     nNextPos = nChildPos = 0;
 
-    szName[0] = szType[0] = '\0';
+    nNameId = nTypeId = 0;
 
     pabyData = NULL;
+    bDataMapped = FALSE;
 
     poType = NULL;
 
 /* -------------------------------------------------------------------- */
-/*      Read the entry information from the file.                       */
+/*      Read the entry information from the file, or directly from      */
+/*      the mapping if we have one.                                     */
 /* -------------------------------------------------------------------- */
     GInt32	anEntryNums[6];
     int		i;
 
-    if( VSIFSeekL( psHFA->fp, nFilePos, SEEK_SET ) == -1
+    if( psHFA->pabyMap != NULL )
+    {
+        if( (vsi_l_offset) nFilePos + 6*4 + 64 + 32 > psHFA->nMapSize )
+        {
+            CPLError( CE_Failure, CPLE_FileIO,
+                      "Entry at %u is past end of file in HFAEntry().",
+                      nFilePos );
+            return;
+        }
+
+        memcpy( anEntryNums, psHFA->pabyMap + nFilePos, 6*4 );
+    }
+    else if( VSIFSeekL( psHFA->fp, nFilePos, SEEK_SET ) == -1
         || VSIFReadL( anEntryNums, sizeof(GInt32), 6, psHFA->fp ) < 1 )
     {
         CPLError( CE_Failure, CPLE_FileIO,
@@ -144,13 +313,23 @@ HFAEntry::HFAEntry( HFAInfo_t * psHFAIn, GUInt32 nPos,
 /* -------------------------------------------------------------------- */
 /*      Read the name, and type.                                        */
 /* -------------------------------------------------------------------- */
-    if( VSIFReadL( szName, 1, 64, psHFA->fp ) < 1
+    char	szName[64], szType[32];
+
+    if( psHFA->pabyMap != NULL )
+    {
+        memcpy( szName, psHFA->pabyMap + nFilePos + 6*4, 64 );
+        memcpy( szType, psHFA->pabyMap + nFilePos + 6*4 + 64, 32 );
+    }
+    else if( VSIFReadL( szName, 1, 64, psHFA->fp ) < 1
         || VSIFReadL( szType, 1, 32, psHFA->fp ) < 1 )
     {
         CPLError( CE_Failure, CPLE_FileIO,
                   "VSIFReadL() failed in HFAEntry()." );
         return;
     }
+
+    nNameId = psHFA->poEntryPool->Intern( szName, sizeof(szName) );
+    nTypeId = psHFA->poEntryPool->Intern( szType, sizeof(szType) );
 }
 
 /************************************************************************/
@@ -160,7 +339,7 @@ HFAEntry::HFAEntry( HFAInfo_t * psHFAIn, GUInt32 nPos,
 /*      would be written to disk later.                                 */
 /************************************************************************/
 
-HFAEntry::HFAEntry( HFAInfo_t * psHFAIn, 
+HFAEntry::HFAEntry( HFAInfo_t * psHFAIn, GUInt32 nIndexIn,
                     const char * pszNodeName, 
                     const char * pszTypeName,
                     HFAEntry * poParentIn )
@@ -170,41 +349,43 @@ HFAEntry::HFAEntry( HFAInfo_t * psHFAIn,
 /*      Initialize Entry                                                */
 /* -------------------------------------------------------------------- */
     psHFA = psHFAIn;
+    nIndex = nIndexIn;
     
     nFilePos = 0;
 
-    poParent = poParentIn;
-    poPrev = poNext = poChild = NULL;
+    nParent = (poParentIn != NULL) ? poParentIn->nIndex : 0;
+    nPrev = nNext = nChild = 0;
 
     nDataPos = nDataSize = 0;
     nNextPos = nChildPos = 0;
 
     SetName( pszNodeName );
-    memset( szType, 0, 32 );
-    strncpy( szType, pszTypeName, 32 );
+    nTypeId = psHFA->poEntryPool->Intern( pszTypeName, 32 );
 
     pabyData = NULL;
+    bDataMapped = FALSE;
     poType = NULL;
 
 /* -------------------------------------------------------------------- */
 /*      Update the previous or parent node to refer to this one.        */
 /* -------------------------------------------------------------------- */
-    if( poParent == NULL )
+    if( poParentIn == NULL )
     {
         /* do nothing */
     }
-    else if( poParent->poChild == NULL )
+    else if( poParentIn->nChild == 0 )
     {
-        poParent->poChild = this;
-        poParent->MarkDirty();
+        poParentIn->nChild = nIndex;
+        poParentIn->MarkDirty();
     }
     else
     {
-        poPrev = poParent->poChild;
-        while( poPrev->poNext != NULL )
-            poPrev = poPrev->poNext;
+        HFAEntry *poPrev = Entry( poParentIn->nChild );
+        while( poPrev->nNext != 0 )
+            poPrev = Entry( poPrev->nNext );
 
-        poPrev->poNext = this;
+        nPrev = poPrev->nIndex;
+        poPrev->nNext = nIndex;
         poPrev->MarkDirty();
     }
 
@@ -214,20 +395,15 @@ HFAEntry::HFAEntry( HFAInfo_t * psHFAIn,
 /************************************************************************/
 /*                             ~HFAEntry()                              */
 /*                                                                      */
-/*      Ensure that children are cleaned up when this node is           */
-/*      cleaned up.                                                     */
+/*      Only the entry's own data is released here, the entries it      */
+/*      links to belong to the pool which destroys them all.            */
 /************************************************************************/
 
 HFAEntry::~HFAEntry()
 
 {
-    CPLFree( pabyData );
-    
-    if( poNext != NULL )
-        delete poNext;
-
-    if( poChild != NULL )
-        delete poChild;
+    if( !bDataMapped )
+        CPLFree( pabyData );
 }
 
 /************************************************************************/
@@ -238,8 +414,7 @@ HFAEntry::~HFAEntry()
 
 void HFAEntry::SetName( const char *pszNodeName )
 {
-  memset( szName, 0, 64 );
-  strncpy( szName, pszNodeName, 64 );
+  nNameId = psHFA->poEntryPool->Intern( pszNodeName, 64 );
 
   MarkDirty();
 }
@@ -254,12 +429,12 @@ HFAEntry *HFAEntry::GetChild()
 /* -------------------------------------------------------------------- */
 /*      Do we need to create the child node?                            */
 /* -------------------------------------------------------------------- */
-    if( poChild == NULL && nChildPos != 0 )
+    if( nChild == 0 && nChildPos != 0 )
     {
-        poChild = new HFAEntry( psHFA, nChildPos, this, NULL );
+        nChild = New( psHFA, nChildPos, this, NULL )->nIndex;
     }
 
-    return( poChild );
+    return( Entry( nChild ) );
 }
 
 /************************************************************************/
@@ -272,12 +447,12 @@ HFAEntry *HFAEntry::GetNext()
 /* -------------------------------------------------------------------- */
 /*      Do we need to create the next node?                             */
 /* -------------------------------------------------------------------- */
-    if( poNext == NULL && nNextPos != 0 )
+    if( nNext == 0 && nNextPos != 0 )
     {
-        poNext = new HFAEntry( psHFA, nNextPos, poParent, this );
+        nNext = New( psHFA, nNextPos, Entry( nParent ), this )->nIndex;
     }
 
-    return( poNext );
+    return( Entry( nNext ) );
 }
 
 /************************************************************************/
@@ -293,6 +468,26 @@ void HFAEntry::LoadData()
     if( pabyData != NULL || nDataSize == 0 )
         return;
 
+/* -------------------------------------------------------------------- */
+/*      If the file is mapped, just point at the data in place.         */
+/* -------------------------------------------------------------------- */
+    if( psHFA->pabyMap != NULL )
+    {
+        if( (vsi_l_offset) nDataPos + nDataSize > psHFA->nMapSize )
+        {
+            CPLError( CE_Failure, CPLE_FileIO,
+                      "Data of %s at %u + %u is past end of file.",
+                      GetName(), nDataPos, nDataSize );
+            return;
+        }
+
+        pabyData = psHFA->pabyMap + nDataPos;
+        bDataMapped = TRUE;
+
+        poType = psHFA->poEntryPool->FindType( nTypeId, psHFA->poDictionary );
+        return;
+    }
+
 /* -------------------------------------------------------------------- */
 /*      Allocate buffer, and read data.                                 */
 /* -------------------------------------------------------------------- */
@@ -314,11 +509,53 @@ void HFAEntry::LoadData()
 /* -------------------------------------------------------------------- */
 /*      Get the type corresponding to this entry.                       */
 /* -------------------------------------------------------------------- */
-    poType = psHFA->poDictionary->FindType( szType );
+    poType = psHFA->poEntryPool->FindType( nTypeId, psHFA->poDictionary );
     if( poType == NULL )
         return;
 }
 
+/************************************************************************/
+/*                            ReleaseData()                             */
+/*                                                                      */
+/*      Drop the data loaded by LoadData() so that long walks over      */
+/*      the tree do not keep every node's data alive.  Modified data    */
+/*      is kept, it has yet to be flushed.  The data is reloaded on     */
+/*      the next access.                                                */
+/************************************************************************/
+
+void HFAEntry::ReleaseData()
+
+{
+    if( pabyData == NULL || bDirty )
+        return;
+
+    if( !bDataMapped )
+        CPLFree( pabyData );
+
+    pabyData = NULL;
+    bDataMapped = FALSE;
+}
+
+/************************************************************************/
+/*                             DetachData()                             */
+/*                                                                      */
+/*      Replace data pointing into the read-only file mapping with a    */
+/*      private heap copy, so that it can be modified or resized.       */
+/************************************************************************/
+
+void HFAEntry::DetachData()
+
+{
+    if( !bDataMapped )
+        return;
+
+    GByte *pabyCopy = (GByte *) CPLMalloc(nDataSize);
+    memcpy( pabyCopy, pabyData, nDataSize );
+
+    pabyData = pabyCopy;
+    bDataMapped = FALSE;
+}
+
 /************************************************************************/
 /*                              MakeData()                              */
 /*                                                                      */
@@ -334,7 +571,7 @@ GByte *HFAEntry::MakeData( int nSize )
 {
     if( poType == NULL )
     {
-        poType = psHFA->poDictionary->FindType( szType );
+        poType = psHFA->poEntryPool->FindType( nTypeId, psHFA->poDictionary );
         if( poType == NULL )
             return NULL;
     }
@@ -342,6 +579,8 @@ GByte *HFAEntry::MakeData( int nSize )
     if( nSize == 0 && poType->nBytes > 0 )
         nSize = poType->nBytes;
 
+    DetachData();
+
     if( (int) nDataSize < nSize && nSize > 0 )
     {
         pabyData = (GByte *) CPLRealloc(pabyData, nSize);
@@ -462,6 +701,49 @@ int HFAEntry::GetFieldValue( const char * pszFieldPath,
                                       chReqType, pReqReturn ) );
 }
 
+/************************************************************************/
+/*                            GetFieldPath()                            */
+/*                                                                      */
+/*      Compiled (and cached) form of a field path for this entry's     */
+/*      type, for use with the HFAFieldPath overloads of the            */
+/*      Get*Field() methods.  Node paths (with ':') are not             */
+/*      supported.                                                      */
+/************************************************************************/
+
+HFAFieldPath *HFAEntry::GetFieldPath( const char * pszFieldPath )
+
+{
+    if( strchr(pszFieldPath,':') != NULL )
+        return NULL;
+
+    LoadData();
+
+    if( poType == NULL )
+        return NULL;
+
+    return poType->GetFieldPath( pszFieldPath );
+}
+
+/************************************************************************/
+/*                           GetFieldValue()                            */
+/************************************************************************/
+
+int HFAEntry::GetFieldValue( HFAFieldPath * poPath,
+                             char chReqType, void *pReqReturn )
+
+{
+    LoadData();
+
+    if( pabyData == NULL || poType == NULL )
+        return FALSE;
+
+    if( poPath == NULL || poPath->poType != poType )
+        return FALSE;
+
+    return( poPath->ExtractInstValue( pabyData, nDataPos, nDataSize,
+                                      chReqType, pReqReturn ) );
+}
+
 /************************************************************************/
 /*                           GetFieldCount()                            */
 /************************************************************************/
@@ -605,6 +887,48 @@ const char *HFAEntry::GetStringField( const char * pszFieldPath, CPLErr *peErr)
     }
 }
 
+/************************************************************************/
+/*                  Get{Int,Double,String}Field(path)                   */
+/*                                                                      */
+/*      As above, but taking a path compiled with GetFieldPath().       */
+/************************************************************************/
+
+GInt32 HFAEntry::GetIntField( HFAFieldPath * poPath, CPLErr *peErr )
+
+{
+    GInt32	nIntValue = 0;
+    int		bOK = GetFieldValue( poPath, 'i', &nIntValue );
+
+    if( peErr != NULL )
+        *peErr = bOK ? CE_None : CE_Failure;
+
+    return bOK ? nIntValue : 0;
+}
+
+double HFAEntry::GetDoubleField( HFAFieldPath * poPath, CPLErr *peErr )
+
+{
+    double	dfDoubleValue = 0.0;
+    int		bOK = GetFieldValue( poPath, 'd', &dfDoubleValue );
+
+    if( peErr != NULL )
+        *peErr = bOK ? CE_None : CE_Failure;
+
+    return bOK ? dfDoubleValue : 0.0;
+}
+
+const char *HFAEntry::GetStringField( HFAFieldPath * poPath, CPLErr *peErr )
+
+{
+    char	*pszResult = NULL;
+    int		bOK = GetFieldValue( poPath, 's', &pszResult );
+
+    if( peErr != NULL )
+        *peErr = bOK ? CE_None : CE_Failure;
+
+    return bOK ? pszResult : NULL;
+}
+
 /************************************************************************/
 /*                           SetFieldValue()                            */
 /************************************************************************/
@@ -709,9 +1033,9 @@ void HFAEntry::SetPosition()
 /* -------------------------------------------------------------------- */
 /*      Force all children to set their position.                       */
 /* -------------------------------------------------------------------- */
-    for( HFAEntry *poThisChild = poChild; 
+    for( HFAEntry *poThisChild = Entry( nChild ); 
          poThisChild != NULL;
-         poThisChild = poThisChild->poNext )
+         poThisChild = Entry( poThisChild->nNext ) )
     {
         poThisChild->SetPosition();
     }
@@ -733,7 +1057,7 @@ CPLErr HFAEntry::FlushToDisk()
 /*      If we are the root node, call SetPosition() on the whole        */
 /*      tree to ensure that all entries have an allocated position.     */
 /* -------------------------------------------------------------------- */
-    if( poParent == NULL )
+    if( nParent == 0 )
         SetPosition();
 
 /* ==================================================================== */
@@ -744,10 +1068,10 @@ CPLErr HFAEntry::FlushToDisk()
 /* -------------------------------------------------------------------- */
 /*      Ensure we know where the relative entries are located.          */
 /* -------------------------------------------------------------------- */
-        if( poNext != NULL )
-            nNextPos = poNext->nFilePos;
-        if( poChild != NULL )
-            nChildPos = poChild->nFilePos;
+        if( nNext != 0 )
+            nNextPos = Entry( nNext )->nFilePos;
+        if( nChild != 0 )
+            nChildPos = Entry( nChild )->nFilePos;
 
 /* -------------------------------------------------------------------- */
 /*      Write the Ehfa_Entry fields.                                    */
@@ -767,15 +1091,15 @@ CPLErr HFAEntry::FlushToDisk()
         HFAStandard( 4, &nLong );
         VSIFWriteL( &nLong, 4, 1, psHFA->fp );
 
-        if( poPrev != NULL )
-            nLong = poPrev->nFilePos;
+        if( nPrev != 0 )
+            nLong = Entry( nPrev )->nFilePos;
         else
             nLong = 0;
         HFAStandard( 4, &nLong );
         VSIFWriteL( &nLong, 4, 1, psHFA->fp );
 
-        if( poParent != NULL )
-            nLong = poParent->nFilePos;
+        if( nParent != 0 )
+            nLong = Entry( nParent )->nFilePos;
         else
             nLong = 0;
         HFAStandard( 4, &nLong );
@@ -794,6 +1118,13 @@ CPLErr HFAEntry::FlushToDisk()
         HFAStandard( 4, &nLong );
         VSIFWriteL( &nLong, 4, 1, psHFA->fp );
 
+        char	szName[64], szType[32];
+
+        memset( szName, 0, sizeof(szName) );
+        strncpy( szName, GetName(), sizeof(szName) );
+        memset( szType, 0, sizeof(szType) );
+        strncpy( szType, GetType(), sizeof(szType) );
+
         VSIFWriteL( szName, 1, 64, psHFA->fp );
         VSIFWriteL( szType, 1, 32, psHFA->fp );
 
@@ -829,9 +1160,9 @@ CPLErr HFAEntry::FlushToDisk()
 /* -------------------------------------------------------------------- */
 /*      Process all the children of this node                           */
 /* -------------------------------------------------------------------- */
-    for( HFAEntry *poThisChild = poChild; 
+    for( HFAEntry *poThisChild = Entry( nChild ); 
          poThisChild != NULL;
-         poThisChild = poThisChild->poNext )
+         poThisChild = Entry( poThisChild->nNext ) )
     {
         eErr = poThisChild->FlushToDisk();
         if( eErr != CE_None )
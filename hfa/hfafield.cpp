@@ -931,7 +931,8 @@ HFAField::ExtractInstValue( const char * pszField, int nIndexValue,
     {
         if( pszStringRet == NULL )
         {
-            static char	szNumber[28]; // This is NOT threadsafe.
+            // per thread, valid until this thread's next call
+            static thread_local char szNumber[28];
 
             sprintf( szNumber, "%d", nIntRet );
             pszStringRet = szNumber;
@@ -962,6 +963,135 @@ HFAField::ExtractInstValue( const char * pszField, int nIndexValue,
     }
 }
 
+/************************************************************************/
+/*                          ExtractBaseData()                           */
+/*                                                                      */
+/*      Decode a whole BASEDATA instance into padfValues (row major     */
+/*      as stored), reading the rows/columns/type header only once.     */
+/*      If padfValues is NULL only the shape is returned, so the        */
+/*      caller can size its buffer.                                     */
+/************************************************************************/
+
+int HFAField::ExtractBaseData( GByte *pabyData, int nDataSize,
+                               int *pnRows, int *pnColumns,
+                               double *padfValues, int nMaxValues )
+
+{
+    GInt32	nRows, nColumns;
+    GInt16	nBaseItemType;
+    int		i, nValues, nItemBytes;
+
+    if( chItemType != 'b' || pabyData == NULL )
+        return FALSE;
+
+    if( chPointer != '\0' )
+    {
+        pabyData += 8;
+        nDataSize -= 8;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Read the header.                                                */
+/* -------------------------------------------------------------------- */
+    if( nDataSize < 12 )
+        return FALSE;
+
+    memcpy( &nRows, pabyData, 4 );
+    HFAStandard( 4, &nRows );
+    memcpy( &nColumns, pabyData+4, 4 );
+    HFAStandard( 4, &nColumns );
+    memcpy( &nBaseItemType, pabyData+8, 2 );
+    HFAStandard( 2, &nBaseItemType );
+
+    pabyData += 12;
+    nDataSize -= 12;
+
+    if( nRows < 0 || nColumns < 0
+        || (nColumns > 0 && nRows > nDataSize / nColumns) )
+        return FALSE;
+
+    nValues = nRows * nColumns;
+    nItemBytes = (HFAGetDataTypeBits(nBaseItemType) + 7) / 8;
+
+    if( nValues > 0 && nItemBytes > nDataSize / nValues )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "BASEDATA %s of %dx%d exceeds its %d bytes of data.",
+                  pszFieldName, nRows, nColumns, nDataSize );
+        return FALSE;
+    }
+
+    *pnRows = nRows;
+    *pnColumns = nColumns;
+
+    if( padfValues == NULL )
+        return TRUE;
+
+    if( nValues > nMaxValues )
+        return FALSE;
+
+/* -------------------------------------------------------------------- */
+/*      Convert the payload.  Each loop is a plain widening copy on     */
+/*      little endian hosts, which the compiler can vectorize.          */
+/* -------------------------------------------------------------------- */
+    switch( nBaseItemType )
+    {
+      case EPT_u8:
+        for( i = 0; i < nValues; i++ )
+            padfValues[i] = pabyData[i];
+        break;
+
+      case EPT_s16:
+        for( i = 0; i < nValues; i++ )
+        {
+            GInt16  nValue;
+
+            memcpy( &nValue, pabyData + 2*i, 2 );
+            HFAStandard( 2, &nValue );
+            padfValues[i] = nValue;
+        }
+        break;
+
+      case EPT_u16:
+        for( i = 0; i < nValues; i++ )
+        {
+            GUInt16 nValue;
+
+            memcpy( &nValue, pabyData + 2*i, 2 );
+            HFAStandard( 2, &nValue );
+            padfValues[i] = nValue;
+        }
+        break;
+
+      case EPT_f32:
+        for( i = 0; i < nValues; i++ )
+        {
+            float   fValue;
+
+            memcpy( &fValue, pabyData + 4*i, 4 );
+            HFAStandard( 4, &fValue );
+            padfValues[i] = fValue;
+        }
+        break;
+
+      case EPT_f64:
+        memcpy( padfValues, pabyData, 8 * nValues );
+#ifndef CPL_LSB
+        for( i = 0; i < nValues; i++ )
+            HFAStandard( 8, padfValues + i );
+#endif
+        break;
+
+      default:
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "BASEDATA %s has unsupported item type %d.",
+                  pszFieldName, nBaseItemType );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 /************************************************************************/
 /*                            GetInstBytes()                            */
 /*                                                                      */
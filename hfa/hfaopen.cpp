@@ -107,6 +107,11 @@
 //#include "gdal_alg.h"
 #include <limits.h>
 
+#ifndef _WIN32
+#  include <sys/mman.h>
+#  define HFA_HAVE_MMAP
+#endif
+
 CPL_CVSID("$Id: hfaopen.cpp,v 1.55 2006/04/19 14:07:03 fwarmerdam Exp $");
 
 
@@ -134,44 +139,182 @@ char ** GetHFAAuxMetaDataList()
 }
 
 
+/************************************************************************/
+/*                        HFAFindDictionaryEnd()                        */
+/*                                                                      */
+/*      Scan pszDict[nStart..nSize) for the end of the dictionary:      */
+/*      either a nul, or the ",." terminator (which is kept).  Returns  */
+/*      the dictionary length, or -1 if the end was not seen yet.       */
+/************************************************************************/
+
+static int HFAFindDictionaryEnd( const char *pszDict, int nStart, int nSize )
+
+{
+    const char *pszNul, *pszDot;
+    const char *pszSearch = pszDict + nStart;
+    int         nLeft = nSize - nStart;
+
+    pszNul = (const char *) memchr( pszSearch, '\0', nLeft );
+    if( pszNul != NULL )
+        nLeft = pszNul - pszSearch;
+
+    while( nLeft > 0
+           && (pszDot = (const char *) memchr( pszSearch, '.', nLeft )) != NULL )
+    {
+        if( pszDot - pszDict >= 2 && pszDot[-1] == ',' )
+            return pszDot - pszDict + 1;
+
+        nLeft -= pszDot + 1 - pszSearch;
+        pszSearch = pszDot + 1;
+    }
+
+    if( pszNul != NULL )
+        return pszNul - pszDict;
+
+    return -1;
+}
+
 /************************************************************************/
 /*                          HFAGetDictionary()                          */
+/*                                                                      */
+/*      Read the dictionary text in large blocks (or straight from      */
+/*      the mapping) rather than one byte at a time.                    */
 /************************************************************************/
 
+#define HFA_DICT_CHUNK  16384
+
 static char * HFAGetDictionary( HFAHandle hHFA )
 
 {
-    int		nDictMax = 100;
-    char	*pszDictionary = (char *) CPLMalloc(nDictMax);
+    char	*pszDictionary;
     int		nDictSize = 0;
+    int		nDictEnd = -1;
+
+/* -------------------------------------------------------------------- */
+/*      Mapped files can be scanned in place.                           */
+/* -------------------------------------------------------------------- */
+    if( hHFA->pabyMap != NULL && hHFA->nDictionaryPos < hHFA->nMapSize )
+    {
+        const char *pszMapped =
+            (const char *) hHFA->pabyMap + hHFA->nDictionaryPos;
+        int         nMapped = (int) (hHFA->nMapSize - hHFA->nDictionaryPos);
+
+        nDictEnd = HFAFindDictionaryEnd( pszMapped, 0, nMapped );
+        if( nDictEnd < 0 )
+            nDictEnd = nMapped;
+
+        pszDictionary = (char *) CPLMalloc(nDictEnd + 1);
+        memcpy( pszDictionary, pszMapped, nDictEnd );
+        pszDictionary[nDictEnd] = '\0';
+
+        return( pszDictionary );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Otherwise read blocks until the terminator or end of file.      */
+/* -------------------------------------------------------------------- */
+    int		nDictMax = HFA_DICT_CHUNK + 1;
+
+    pszDictionary = (char *) CPLMalloc(nDictMax);
 
     VSIFSeekL( hHFA->fp, hHFA->nDictionaryPos, SEEK_SET );
 
-    while( TRUE )
+    while( nDictEnd < 0 )
     {
-        if( nDictSize >= nDictMax-1 )
+        int	nRead;
+
+        if( nDictSize + HFA_DICT_CHUNK >= nDictMax )
         {
-            nDictMax = nDictSize * 2 + 100;
+            nDictMax = nDictSize * 2 + HFA_DICT_CHUNK + 1;
             pszDictionary = (char *) CPLRealloc(pszDictionary, nDictMax );
         }
 
-        if( VSIFReadL( pszDictionary + nDictSize, 1, 1, hHFA->fp ) < 1
-            || pszDictionary[nDictSize] == '\0'
-            || (nDictSize > 2 && pszDictionary[nDictSize-2] == ','
-                && pszDictionary[nDictSize-1] == '.') )
-            break;
+        nRead = (int) VSIFReadL( pszDictionary + nDictSize, 1, HFA_DICT_CHUNK,
+                                 hHFA->fp );
 
-        nDictSize++;
-    }
+        nDictEnd = HFAFindDictionaryEnd( pszDictionary, nDictSize,
+                                         nDictSize + nRead );
+        nDictSize += nRead;
 
-    pszDictionary[nDictSize] = '\0';
+        if( nRead < HFA_DICT_CHUNK && nDictEnd < 0 )
+            nDictEnd = nDictSize;
+    }
 
+    pszDictionary[nDictEnd] = '\0';
 
     return( pszDictionary );
 }
 
+/************************************************************************/
+/*                             HFAMapFile()                             */
+/*                                                                      */
+/*      Map the whole file read-only so that entry headers and data     */
+/*      can be accessed in place.  The mapping is made from the         */
+/*      native descriptor behind the handle's VSI file, so only         */
+/*      plain filesystem paths are mapped; /vsi* paths have no such     */
+/*      descriptor.  Returns FALSE (leaving the handle on the VSI       */
+/*      path) if mapping is not available.                              */
+/************************************************************************/
+
+static int HFAMapFile( HFAInfo_t *psInfo )
+
+{
+#ifdef HFA_HAVE_MMAP
+    void	*pFD;
+    void	*pMap;
+
+    if( psInfo->nEndOfFile == 0 )
+        return FALSE;
+
+    pFD = VSIFGetNativeFileDescriptorL( psInfo->fp );
+    if( pFD == NULL )
+    {
+        CPLDebug( "HFA", "%s has no native descriptor, using VSI.",
+                  psInfo->pszFilename );
+        return FALSE;
+    }
+
+    pMap = mmap( NULL, (size_t) psInfo->nEndOfFile, PROT_READ, MAP_PRIVATE,
+                 (int) (size_t) pFD, 0 );
+
+    if( pMap == MAP_FAILED )
+    {
+        CPLDebug( "HFA", "mmap() of %s failed, using VSI.",
+                  psInfo->pszFilename );
+        return FALSE;
+    }
+
+    psInfo->pabyMap = (GByte *) pMap;
+    psInfo->nMapSize = (vsi_l_offset) psInfo->nEndOfFile;
+
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/************************************************************************/
+/*                            HFAUnmapFile()                            */
+/************************************************************************/
+
+static void HFAUnmapFile( HFAInfo_t *psInfo )
+
+{
+#ifdef HFA_HAVE_MMAP
+    if( psInfo->pabyMap != NULL )
+        munmap( psInfo->pabyMap, (size_t) psInfo->nMapSize );
+#endif
+    psInfo->pabyMap = NULL;
+    psInfo->nMapSize = 0;
+}
+
 /************************************************************************/
 /*                              HFAOpen()                               */
+/*                                                                      */
+/*      pszAccess is "r"/"rb" for read-only access, "rm" for            */
+/*      read-only access through a memory mapping of the file (falls    */
+/*      back to "r" where mapping is unavailable), or anything else     */
+/*      for update access.                                              */
 /************************************************************************/
 
 HFAHandle HFAOpen( const char * pszFilename, const char * pszAccess )
@@ -181,11 +324,12 @@ HFAHandle HFAOpen( const char * pszFilename, const char * pszAccess )
     char	szHeader[16];
     HFAInfo_t	*psInfo;
     GUInt32	nHeaderPos;
+    int         bMapped = EQUAL(pszAccess,"rm");
 
 /* -------------------------------------------------------------------- */
 /*      Open the file.                                                  */
 /* -------------------------------------------------------------------- */
-    if( EQUAL(pszAccess,"r") || EQUAL(pszAccess,"rb" ) )
+    if( EQUAL(pszAccess,"r") || EQUAL(pszAccess,"rb" ) || bMapped )
         fp = VSIFOpenL( pszFilename, "rb" );
     else
         fp = VSIFOpenL( pszFilename, "r+b" );
@@ -230,7 +374,7 @@ HFAHandle HFAOpen( const char * pszFilename, const char * pszAccess )
     psInfo->pszFilename = CPLStrdup(CPLGetFilename(pszFilename));
     psInfo->pszPath = CPLStrdup(CPLGetPath(pszFilename));
     psInfo->fp = fp;
-    if( EQUAL(pszAccess,"r") || EQUAL(pszAccess,"rb" ) )
+    if( EQUAL(pszAccess,"r") || EQUAL(pszAccess,"rb" ) || bMapped )
 	psInfo->eAccess = HFA_ReadOnly;
     else
 	psInfo->eAccess = HFA_Update;
@@ -267,16 +411,23 @@ HFAHandle HFAOpen( const char * pszFilename, const char * pszAccess )
     VSIFSeekL( fp, 0, SEEK_END );
     psInfo->nEndOfFile = (GUInt32) VSIFTellL( fp );
 
+/* -------------------------------------------------------------------- */
+/*      Map the file if requested.  Entries then read their headers     */
+/*      and data directly from the mapping instead of through fp.       */
+/* -------------------------------------------------------------------- */
+    if( bMapped )
+        HFAMapFile( psInfo );
+
 /* -------------------------------------------------------------------- */
 /*      Instantiate the root entry.                                     */
 /* -------------------------------------------------------------------- */
-    psInfo->poRoot = new HFAEntry( psInfo, psInfo->nRootPos, NULL, NULL );
+    psInfo->poRoot = HFAEntry::New( psInfo, psInfo->nRootPos, NULL, NULL );
 
 /* -------------------------------------------------------------------- */
 /*      Read the dictionary                                             */
 /* -------------------------------------------------------------------- */
     psInfo->pszDictionary = HFAGetDictionary( psInfo );
-    psInfo->poDictionary = new HFADictionary( psInfo->pszDictionary );
+    psInfo->poDictionary = HFADictionary::Acquire( psInfo->pszDictionary );
 
 /* -------------------------------------------------------------------- */
 /*      Collect band definitions.                                       */
@@ -326,8 +477,8 @@ HFAInfo_t *HFACreateDependent( HFAInfo_t *psBase )
 /*      Add the DependentFile node with the pointer back to the         */
 /*      parent.                                                         */
 /* -------------------------------------------------------------------- */
-    HFAEntry *poDF = new HFAEntry( psDep, "DependentFile", 
-                                   "Eimg_DependentFile", psDep->poRoot );
+    HFAEntry *poDF = HFAEntry::New( psDep, "DependentFile", 
+                                    "Eimg_DependentFile", psDep->poRoot );
 
     poDF->MakeData( strlen(psBase->pszFilename) + 50 );
     poDF->SetPosition();
@@ -439,12 +590,13 @@ void HFAClose( HFAHandle hHFA )
     if( hHFA->psDependent != NULL )
         HFAClose( hHFA->psDependent );
 
-    delete hHFA->poRoot;
+    delete hHFA->poEntryPool;
+
+    HFAUnmapFile( hHFA );
 
     VSIFCloseL( hHFA->fp );
 
-    if( hHFA->poDictionary != NULL )
-        delete hHFA->poDictionary;
+    HFADictionary::Release( hHFA->poDictionary );
 
     CPLFree( hHFA->pszDictionary );
     CPLFree( hHFA->pszFilename );
@@ -1074,8 +1226,8 @@ CPLErr HFASetMapInfo( HFAHandle hHFA, const Eprj_MapInfo *poMapInfo )
         poMIEntry = hHFA->papoBand[iBand]->poNode->GetNamedChild( "Map_Info" );
         if( poMIEntry == NULL )
         {
-            poMIEntry = new HFAEntry( hHFA, "Map_Info", "Eprj_MapInfo",
-                                      hHFA->papoBand[iBand]->poNode );
+            poMIEntry = HFAEntry::New( hHFA, "Map_Info", "Eprj_MapInfo",
+                                       hHFA->papoBand[iBand]->poNode );
         }
 
         poMIEntry->MarkDirty();
@@ -1202,8 +1354,8 @@ CPLErr HFASetProParameters( HFAHandle hHFA, const Eprj_ProParameters *poPro )
         poMIEntry = hHFA->papoBand[iBand]->poNode->GetNamedChild("Projection");
         if( poMIEntry == NULL )
         {
-            poMIEntry = new HFAEntry( hHFA, "Projection","Eprj_ProParameters",
-                                      hHFA->papoBand[iBand]->poNode );
+            poMIEntry = HFAEntry::New( hHFA, "Projection","Eprj_ProParameters",
+                                       hHFA->papoBand[iBand]->poNode );
         }
 
         poMIEntry->MarkDirty();
@@ -1346,7 +1498,7 @@ CPLErr HFASetDatum( HFAHandle hHFA, const Eprj_Datum *poDatum )
         poDatumEntry = poProParms->GetNamedChild("Datum");
         if( poDatumEntry == NULL )
         {
-            poDatumEntry = new HFAEntry( hHFA, "Datum","Eprj_Datum",
+            poDatumEntry = HFAEntry::New( hHFA, "Datum","Eprj_Datum",
                                       poProParms );
         }
 
@@ -1458,7 +1610,7 @@ static void	HFADumpNode( HFAEntry *poEntry, int nIndent, int bVerbose,
                              FILE * fp )
 
 {
-    static char	szSpaces[256];
+    char	szSpaces[256];
     int		i;
 
     for( i = 0; i < nIndent*2; i++ )
@@ -1648,14 +1800,14 @@ HFAHandle HFACreateLL( const char * pszFilename )
     VSIFWriteL( (void *) psInfo->pszDictionary, 1,
                 strlen(psInfo->pszDictionary)+1, fp );
 
-    psInfo->poDictionary = new HFADictionary( psInfo->pszDictionary );
+    psInfo->poDictionary = HFADictionary::Acquire( psInfo->pszDictionary );
 
     psInfo->nEndOfFile = (GUInt32) VSIFTellL( fp );
 
 /* -------------------------------------------------------------------- */
 /*      Create a root entry.                                            */
 /* -------------------------------------------------------------------- */
-    psInfo->poRoot = new HFAEntry( psInfo, "root", "root", NULL );
+    psInfo->poRoot = HFAEntry::New( psInfo, "root", "root", NULL );
 
     return psInfo;
 }
@@ -1769,7 +1921,7 @@ HFACreateLayer( HFAHandle psInfo, HFAEntry *poParent,
 /*      Create the Eimg_Layer for the band.                             */
 /* -------------------------------------------------------------------- */
     poEimg_Layer =
-        new HFAEntry( psInfo, pszLayerName, pszLayerType, poParent );
+        HFAEntry::New( psInfo, pszLayerName, pszLayerType, poParent );
 
     poEimg_Layer->SetIntField( "width", nXSize );
     poEimg_Layer->SetIntField( "height", nYSize );
@@ -1791,7 +1943,7 @@ HFACreateLayer( HFAHandle psInfo, HFAEntry *poParent,
         GByte	*pabyData;
 
         poEdms_State =
-            new HFAEntry( psInfo, "RasterDMS", "Edms_State", poEimg_Layer );
+            HFAEntry::New( psInfo, "RasterDMS", "Edms_State", poEimg_Layer );
 
         nDmsSize = 14 * nBlocks + 38;
         pabyData = poEdms_State->MakeData( nDmsSize );
@@ -1893,8 +2045,8 @@ HFACreateLayer( HFAHandle psInfo, HFAEntry *poParent,
         HFAEntry *poEdms_State;
 
         poEdms_State =
-            new HFAEntry( psInfo, "ExternalRasterDMS",
-                          "ImgExternalRaster", poEimg_Layer );
+            HFAEntry::New( psInfo, "ExternalRasterDMS",
+                           "ImgExternalRaster", poEimg_Layer );
         poEdms_State->MakeData( 8 + strlen(psInfo->pszIGEFilename) + 1 + 6 * 4 );
 
         poEdms_State->SetStringField( "fileName.string", 
@@ -1957,8 +2109,8 @@ HFACreateLayer( HFAHandle psInfo, HFAEntry *poParent,
     // the first value in the entry below gives the number of pixels within a block
     sprintf( szLDict, "{%d:%cdata,}RasterDMS,.", nBlockSize*nBlockSize, chBandType );
 
-    poEhfa_Layer = new HFAEntry( psInfo, "Ehfa_Layer", "Ehfa_Layer",
-                                 poEimg_Layer );
+    poEhfa_Layer = HFAEntry::New( psInfo, "Ehfa_Layer", "Ehfa_Layer",
+                                  poEimg_Layer );
     poEhfa_Layer->MakeData();
     poEhfa_Layer->SetPosition();
     nLDict = HFAAllocateSpace( psInfo, strlen(szLDict) + 1 );
@@ -2017,8 +2169,8 @@ HFAHandle HFACreate( const char * pszFilename,
 
     if( pszDependentFile != NULL )
     {
-        HFAEntry *poDF = new HFAEntry( psInfo, "DependentFile", 
-                                       "Eimg_DependentFile", psInfo->poRoot );
+        HFAEntry *poDF = HFAEntry::New( psInfo, "DependentFile", 
+                                        "Eimg_DependentFile", psInfo->poRoot );
 
         poDF->MakeData( strlen(pszDependentFile) + 50 );
         poDF->SetPosition();
@@ -2060,8 +2212,8 @@ HFAHandle HFACreate( const char * pszFilename,
     // erdas imagine always creates this entry no matter if an external
     // spill file is used or not
     HFAEntry *poImgFormat;
-    poImgFormat = new HFAEntry( psInfo, "IMGFormatInfo",
-                                "ImgFormatInfo831", psInfo->poRoot );
+    poImgFormat = HFAEntry::New( psInfo, "IMGFormatInfo",
+                                 "ImgFormatInfo831", psInfo->poRoot );
     poImgFormat->MakeData();
     if ( bCreateLargeRaster )
     {
@@ -2249,8 +2401,8 @@ HFASetGDALMetadata( HFAHandle hHFA, int nBand, char **papszMD )
 /* -------------------------------------------------------------------- */
     HFAEntry	*poEdsc_Table;
 
-    poEdsc_Table = new HFAEntry( hHFA, "GDAL_MetaData", "Edsc_Table",
-                                 poNode );
+    poEdsc_Table = HFAEntry::New( hHFA, "GDAL_MetaData", "Edsc_Table",
+                                  poNode );
 
     poEdsc_Table->SetIntField( "numrows", 1 );
 
@@ -2261,8 +2413,8 @@ HFASetGDALMetadata( HFAHandle hHFA, int nBand, char **papszMD )
     HFAEntry       *poEdsc_BinFunction;
 
     poEdsc_BinFunction =
-        new HFAEntry( hHFA, "#Bin_Function#", "Edsc_BinFunction",
-                      poEdsc_Table );
+        HFAEntry::New( hHFA, "#Bin_Function#", "Edsc_BinFunction",
+                       poEdsc_Table );
 
     // Because of the BaseData we have to hardcode the size. 
     poEdsc_BinFunction->MakeData( 30 );
@@ -2288,8 +2440,8 @@ HFASetGDALMetadata( HFAHandle hHFA, int nBand, char **papszMD )
 /* -------------------------------------------------------------------- */
 /*      Create the Edsc_Column.                                         */
 /* -------------------------------------------------------------------- */
-        poEdsc_Column = new HFAEntry( hHFA, pszKey, "Edsc_Column",
-                                      poEdsc_Table );
+        poEdsc_Column = HFAEntry::New( hHFA, pszKey, "Edsc_Column",
+                                       poEdsc_Table );
         poEdsc_Column->SetIntField( "numRows", 1 );
         poEdsc_Column->SetStringField( "dataType", "string" );
         poEdsc_Column->SetIntField( "maxNumChars", strlen(pszValue)+1 );
@@ -2368,8 +2520,8 @@ CPLErr HFASetMetadata( HFAHandle hHFA, int nBand, char **papszMD )
             if( poEntry == NULL && strlen(pszAuxMetaData[i+3]) > 0 )
             {
                 // child does not yet exist --> create it
-                poEntry = new HFAEntry( hHFA, pszAuxMetaData[i], pszAuxMetaData[i+3],
-                                        poNode );
+                poEntry = HFAEntry::New( hHFA, pszAuxMetaData[i], pszAuxMetaData[i+3],
+                                         poNode );
                 if ( EQUALN( "HistogramParameters", pszAuxMetaData[i], 19 ) )
                 {
                     // this is a bit nasty I need to set the string field for the object
@@ -2436,11 +2588,11 @@ CPLErr HFASetMetadata( HFAHandle hHFA, int nBand, char **papszMD )
             double dMinLimit = poEntry->GetDoubleField( "BinFunction.minLimit" );
             double dMaxLimit = poEntry->GetDoubleField( "BinFunction.maxLimit" );
             // fill the descriptor table
-            poEntry = new HFAEntry( hHFA, "Descriptor_Table", "Edsc_Table", poNode );
+            poEntry = HFAEntry::New( hHFA, "Descriptor_Table", "Edsc_Table", poNode );
             poEntry->SetIntField( "numRows", nNumBins );
             // bin function
-            HFAEntry * poBinFunc = new HFAEntry( hHFA, "#Bin_Function#", "Edsc_BinFunction",
-                                                 poEntry );
+            HFAEntry * poBinFunc = HFAEntry::New( hHFA, "#Bin_Function#", "Edsc_BinFunction",
+                                                  poEntry );
             poBinFunc->MakeData( 30 );
             poBinFunc->SetIntField( "numBins", nNumBins );
             poBinFunc->SetDoubleField( "minLimit", dMinLimit );
@@ -2448,8 +2600,8 @@ CPLErr HFASetMetadata( HFAHandle hHFA, int nBand, char **papszMD )
             poBinFunc->SetStringField( "binFunctionType", "linear" ); // we use always a linear
 
             // we need a child named histogram
-            HFAEntry * poHisto = new HFAEntry( hHFA, "Histogram", "Edsc_Column",
-                                               poEntry );
+            HFAEntry * poHisto = HFAEntry::New( hHFA, "Histogram", "Edsc_Column",
+                                                poEntry );
             poHisto->SetIntField( "numRows", nNumBins );
             // allocate space for the bin values
             GUInt32 nOffset = HFAAllocateSpace( hHFA, nNumBins*4 );
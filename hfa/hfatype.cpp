@@ -66,6 +66,9 @@
 
 #include "hfa_p.h"
 
+#include <mutex>
+#include <shared_mutex>
+
 CPL_CVSID("$Id: hfatype.cpp,v 1.11 2006/05/07 04:04:03 fwarmerdam Exp $");
 
 /************************************************************************/
@@ -104,6 +107,10 @@ HFAType::~HFAType()
     CPLFree( papoFields );
 
     CPLFree( pszTypeName );
+
+    std::map<std::string, HFAFieldPath *>::iterator oIter;
+    for( oIter = oFieldPaths.begin(); oIter != oFieldPaths.end(); ++oIter )
+        delete oIter->second;
 }
 
 /************************************************************************/
@@ -506,3 +513,243 @@ int HFAType::GetInstBytes( GByte * pabyData )
         return( nTotal );
     }
 }
+
+/************************************************************************/
+/*                            GetFieldPath()                            */
+/*                                                                      */
+/*      Return the compiled form of a field path for this type,         */
+/*      compiling it on first use.  Returns NULL (also cached) if       */
+/*      the path does not resolve against this type.                    */
+/************************************************************************/
+
+HFAFieldPath *HFAType::GetFieldPath( const char * pszFieldPath )
+
+{
+    std::map<std::string, HFAFieldPath *>::iterator oIter;
+
+/* -------------------------------------------------------------------- */
+/*      Already compiled paths only need a shared lock on this type.    */
+/* -------------------------------------------------------------------- */
+    {
+        std::shared_lock<std::shared_mutex> oLock( oFieldPathLock );
+
+        oIter = oFieldPaths.find( pszFieldPath );
+        if( oIter != oFieldPaths.end() )
+            return oIter->second;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Compile it, unless another thread did in the meantime.          */
+/* -------------------------------------------------------------------- */
+    std::unique_lock<std::shared_mutex> oLock( oFieldPathLock );
+
+    oIter = oFieldPaths.find( pszFieldPath );
+    if( oIter != oFieldPaths.end() )
+        return oIter->second;
+
+    HFAFieldPath *poPath = HFAFieldPath::Compile( this, pszFieldPath );
+    oFieldPaths[pszFieldPath] = poPath;
+
+    return poPath;
+}
+
+/************************************************************************/
+/* ==================================================================== */
+/*      		       HFAFieldPath				*/
+/* ==================================================================== */
+/************************************************************************/
+
+/************************************************************************/
+/*                            HFAFieldPath()                            */
+/************************************************************************/
+
+HFAFieldPath::HFAFieldPath()
+
+{
+    poType = NULL;
+    nSteps = 0;
+    papoStepTypes = NULL;
+    panStepField = NULL;
+    panStepOffset = NULL;
+    panStepIndex = NULL;
+}
+
+/************************************************************************/
+/*                           ~HFAFieldPath()                            */
+/************************************************************************/
+
+HFAFieldPath::~HFAFieldPath()
+
+{
+    CPLFree( papoStepTypes );
+    CPLFree( panStepField );
+    CPLFree( panStepOffset );
+    CPLFree( panStepIndex );
+}
+
+/************************************************************************/
+/*                              Compile()                               */
+/*                                                                      */
+/*      Resolve a path of the form fieldname{[index]}{.fieldname...}    */
+/*      against poType.  Intermediate fields must be objects.           */
+/************************************************************************/
+
+HFAFieldPath *HFAFieldPath::Compile( HFAType *poType,
+                                     const char * pszFieldPath )
+
+{
+    HFAFieldPath *poPath = new HFAFieldPath();
+    HFAType	*poStepType = poType;
+    const char	*pszStep = pszFieldPath;
+
+    poPath->poType = poType;
+
+    while( TRUE )
+    {
+        int		nNameLen, nArrayIndex = 0, iField, nByteOffset = 0;
+        const char	*pszNext;
+
+/* -------------------------------------------------------------------- */
+/*      Parse this step's field name and optional index.                */
+/* -------------------------------------------------------------------- */
+        nNameLen = strcspn( pszStep, "[." );
+        pszNext = pszStep + nNameLen;
+
+        if( *pszNext == '[' )
+        {
+            nArrayIndex = atoi( pszNext + 1 );
+            pszNext = strchr( pszNext, ']' );
+            if( pszNext == NULL )
+                break;
+            pszNext++;
+        }
+
+        if( *pszNext != '.' && *pszNext != '\0' )
+            break;
+
+/* -------------------------------------------------------------------- */
+/*      Find the field, noting its offset if everything before it       */
+/*      has a fixed size.                                               */
+/* -------------------------------------------------------------------- */
+        for( iField = 0; iField < poStepType->nFields; iField++ )
+        {
+            HFAField *poField = poStepType->papoFields[iField];
+
+            if( EQUALN(pszStep,poField->pszFieldName,nNameLen)
+                && poField->pszFieldName[nNameLen] == '\0' )
+                break;
+
+            if( poField->nBytes < 0 || nByteOffset < 0 )
+                nByteOffset = -1;
+            else
+                nByteOffset += poField->nBytes;
+        }
+
+        if( iField == poStepType->nFields )
+            break;
+
+        int iStep = poPath->nSteps++;
+
+        poPath->papoStepTypes = (HFAType **)
+            CPLRealloc( poPath->papoStepTypes, sizeof(void*) * poPath->nSteps );
+        poPath->panStepField = (int *)
+            CPLRealloc( poPath->panStepField, sizeof(int) * poPath->nSteps );
+        poPath->panStepOffset = (int *)
+            CPLRealloc( poPath->panStepOffset, sizeof(int) * poPath->nSteps );
+        poPath->panStepIndex = (int *)
+            CPLRealloc( poPath->panStepIndex, sizeof(int) * poPath->nSteps );
+
+        poPath->papoStepTypes[iStep] = poStepType;
+        poPath->panStepField[iStep] = iField;
+        poPath->panStepOffset[iStep] = nByteOffset;
+        poPath->panStepIndex[iStep] = nArrayIndex;
+
+        if( *pszNext == '\0' )
+            return poPath;
+
+/* -------------------------------------------------------------------- */
+/*      Descend into the object type for the next step.                 */
+/* -------------------------------------------------------------------- */
+        HFAField *poField = poStepType->papoFields[iField];
+
+        if( poField->chItemType != 'o' || poField->poItemObjectType == NULL )
+            break;
+
+        poStepType = poField->poItemObjectType;
+        pszStep = pszNext + 1;
+    }
+
+    CPLDebug( "HFAFieldPath", "Unable to compile %s against %s.",
+              pszFieldPath, poType->pszTypeName );
+    delete poPath;
+
+    return NULL;
+}
+
+/************************************************************************/
+/*                          ExtractInstValue()                          */
+/*                                                                      */
+/*      Equivalent to HFAType::ExtractInstValue() for the original      */
+/*      path string, applied to an instance of poType.                  */
+/************************************************************************/
+
+int HFAFieldPath::ExtractInstValue( GByte *pabyData, GUInt32 nDataOffset,
+                                    int nDataSize,
+                                    char chReqType, void *pReqReturn )
+
+{
+    int		nOffset = 0;
+    int		iStep;
+
+    for( iStep = 0; iStep < nSteps; iStep++ )
+    {
+        HFAType  *poStepType = papoStepTypes[iStep];
+        HFAField *poField = poStepType->papoFields[panStepField[iStep]];
+        int	 nIndex = panStepIndex[iStep];
+
+/* -------------------------------------------------------------------- */
+/*      Locate the field within the current instance.                   */
+/* -------------------------------------------------------------------- */
+        if( panStepOffset[iStep] >= 0 )
+            nOffset += panStepOffset[iStep];
+        else
+        {
+            int iField;
+
+            for( iField = 0; iField < panStepField[iStep]; iField++ )
+                nOffset += poStepType->papoFields[iField]->
+                    GetInstBytes( pabyData + nOffset );
+        }
+
+        if( iStep == nSteps - 1 )
+            return( poField->ExtractInstValue( NULL, nIndex,
+                                               pabyData + nOffset,
+                                               nDataOffset + nOffset,
+                                               nDataSize - nOffset,
+                                               chReqType, pReqReturn ) );
+
+/* -------------------------------------------------------------------- */
+/*      Step into the nIndex'th instance of the object.                 */
+/* -------------------------------------------------------------------- */
+        HFAType *poItemType = poField->poItemObjectType;
+
+        if( nIndex < 0
+            || nIndex >= poField->GetInstCount( pabyData + nOffset ) )
+            return FALSE;
+
+        if( poField->chPointer != '\0' )
+            nOffset += 8;
+
+        if( poItemType->nBytes > 0 )
+            nOffset += poItemType->nBytes * nIndex;
+        else
+        {
+            int i;
+
+            for( i = 0; i < nIndex; i++ )
+                nOffset += poItemType->GetInstBytes( pabyData + nOffset );
+        }
+    }
+
+    return FALSE;
+}
@@ -1,15 +1,30 @@
 #include <iomanip>
+#include <mutex>
 
 #include "ovr2shp.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define HFA_HAVE_SSE2
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define HFA_HAVE_AVX2_DISPATCH
+#endif
+#endif
+
 using namespace std;
 
+HFAGeomFactory geomFactory;
+
 static const bool registeredText =
-    geomFactory.registerFactory(10, "TEXT", geomBuilder<HFAText>);
-static const bool registeredRect =
-    geomFactory.registerFactory(13, "RECTANGLE", geomBuilder<HFARectangle>);
-static const bool registeredElli =
-    geomFactory.registerFactory(14, "ELLIPSE", geomBuilder<HFAEllipse>);
+    geomFactory.registerFactory(
+        10, "TEXT",
+        geomBuilder<HFAText, HFATextFields, &HFAEantFields::text>);
+static const bool registeredRect = geomFactory.registerFactory(
+    13, "RECTANGLE",
+    geomBuilder<HFARectangle, HFARectangleFields, &HFAEantFields::rectangle>);
+static const bool registeredElli = geomFactory.registerFactory(
+    14, "ELLIPSE",
+    geomBuilder<HFAEllipse, HFAEllipseFields, &HFAEantFields::ellipse>);
 static const bool registeredPoly =
     geomFactory.registerFactory(15, "POLYGON", geomBuilder<HFAPolygon>);
 static const bool registeredLine =
@@ -20,15 +35,12 @@ extern const string HFA_ANNOTATION_XFORM_ATTR_NAME = "xformMatrix";
 extern const string HFA_XFORM_COEF_ATTR_NAME = "polycoefmtx";
 extern const string HFA_XFORM_VECT_ATTR_NAME = "polycoefvector";
 
-template <typename T, typename U>
-pair<T, U> operator-(const pair<T, U> &l, double *r) {
-    return {l.first - r[0], l.second - r[1]};
-}
+static const double HFA_PI = 3.14159265358979323846;
 
-template <typename T, typename U>
-pair<T, U> operator+(const pair<T, U> &l, double *r) {
-    return {l.first + r[0], l.second + r[1]};
-}
+// upper bound on ellipse segments for very small arc tolerances
+static const int HFA_MAX_ARC_SEGMENTS = 1 << 16;
+
+double HFAEllipse::arcTolerance = 0.0;
 
 /************************************************************************/
 /*                                                                      */
@@ -73,20 +85,14 @@ string to_ptWKT(double x, double y) {
  *
  * Construct Polygon wkt (well-known text) from points
  *
- * @param  pts	 vector<pair<double, double>>
+ * @param  pts	 const HFACoordView&
  * @return string  polygon wkt
  */
-string to_polyWKT(vector<pair<double, double>> pts) {
+string to_polyWKT(const HFACoordView &pts) {
     string wkt = "POLYGON ((";
-    vector<pair<double, double>>::const_iterator it;
-    for (it = pts.begin(); it != pts.end(); ++it) {
-        pair<double, double> pt = *it;
-        if (it == pts.end() - 1) {
-            wkt += to_str(pt.first) + " " + to_str(pt.second);
-            wkt += "))";
-        } else {
-            wkt += to_str(pt.first) + " " + to_str(pt.second) + ", ";
-        }
+    for (size_t i = 0; i < pts.size(); i++) {
+        wkt += to_str(pts.x(i)) + " " + to_str(pts.y(i));
+        wkt += (i == pts.size() - 1) ? "))" : ", ";
     }
 
     return wkt;
@@ -97,60 +103,165 @@ string to_polyWKT(vector<pair<double, double>> pts) {
  *
  * Construct LineString wkt (well-known text) from points
  *
- * @param  pts	 vector<pair<double, double>>
+ * @param  pts	 const HFACoordView&
  * @return string  polygon wkt
  */
-string to_linestrWKT(vector<pair<double, double>> pts) {
+string to_linestrWKT(const HFACoordView &pts) {
     string wkt = "LINESTRING(";
-    vector<pair<double, double>>::const_iterator it;
-    for (it = pts.begin(); it != pts.end(); ++it) {
-        pair<double, double> pt = *it;
-        if (it == pts.end() - 1) {
-            wkt += to_str(pt.first) + " " + to_str(pt.second);
-            wkt += ")";
-        } else {
-            wkt += to_str(pt.first) + " " + to_str(pt.second) + ", ";
-        }
+    for (size_t i = 0; i < pts.size(); i++) {
+        wkt += to_str(pts.x(i)) + " " + to_str(pts.y(i));
+        wkt += (i == pts.size() - 1) ? ")" : ", ";
     }
 
     return wkt;
 }
 
 /*
- * rotate [utility]
+ * rotation_xform [utility]
+ *
+ * affine (xform layout) rotating points anti-clockwise about center
+ *
+ * @param center	const double* center of rotation
+ * @param orientation	double	rotation angle (rad)
+ * @param m		double*	6 element affine
+ */
+void rotation_xform(const double *center, double orientation, double *m) {
+    double costheta = cos(orientation);
+    double sintheta = sin(orientation);
+
+    m[0] = costheta;
+    m[1] = sintheta;
+    m[2] = -sintheta;
+    m[3] = costheta;
+    m[4] = center[0] - costheta * center[0] + sintheta * center[1];
+    m[5] = center[1] - sintheta * center[0] - costheta * center[1];
+}
+
+/*
+ * compose_xform [utility]
+ *
+ * combine two affines into one that applies inner first, then outer
+ *
+ * @param outer	const double*
+ * @param inner	const double*
+ * @param m	double*	6 element result, may not alias the inputs
+ */
+void compose_xform(const double *outer, const double *inner, double *m) {
+    m[0] = inner[0] * outer[0] + inner[1] * outer[2];
+    m[1] = inner[0] * outer[1] + inner[1] * outer[3];
+    m[2] = inner[2] * outer[0] + inner[3] * outer[2];
+    m[3] = inner[2] * outer[1] + inner[3] * outer[3];
+    m[4] = inner[4] * outer[0] + inner[5] * outer[2] + outer[4];
+    m[5] = inner[4] * outer[1] + inner[5] * outer[3] + outer[5];
+}
+
+/*
+ * is_identity_xform [utility]
  *
- * rotate anti-clockwise a (x, y) vector by a specified rad angle
+ * @param m	const double* 6 element affine
  *
- * @param coord	pair<double, double> vector coordinates
- * @param rad   double  rotation angle
+ * @return bool true if m leaves every point unchanged
+ */
+bool is_identity_xform(const double *m) {
+    return m[0] == 1.0 && m[1] == 0.0 && m[2] == 0.0 && m[3] == 1.0 &&
+           m[4] == 0.0 && m[5] == 0.0;
+}
+
+/*
+ * affine_transform_scalar [utility]
  *
- * @return pair<double, double> rotated vector coordinates
+ * x' = x * m[0] + y * m[2] + m[4]
+ * y' = x * m[1] + y * m[3] + m[5]
+ *
+ * the vector kernels below evaluate the same expressions in the same order,
+ * so all paths give identical results
  */
-pair<double, double> rotate(pair<double, double> coord, double rad) {
-    double costheta = cos(rad);
-    double sintheta = sin(rad);
+static void affine_transform_scalar(double *xs, double *ys, size_t n,
+                                    const double *m) {
+    for (size_t i = 0; i < n; i++) {
+        double x = xs[i];
+        double y = ys[i];
+
+        xs[i] = (x * m[0] + y * m[2]) + m[4];
+        ys[i] = (x * m[1] + y * m[3]) + m[5];
+    }
+}
 
-    return make_pair(costheta * coord.first - sintheta * coord.second,
-                     costheta * coord.second + sintheta * coord.first);
+#ifdef HFA_HAVE_SSE2
+static size_t affine_transform_sse2(double *xs, double *ys, size_t n,
+                                    const double *m) {
+    __m128d m0 = _mm_set1_pd(m[0]), m1 = _mm_set1_pd(m[1]);
+    __m128d m2 = _mm_set1_pd(m[2]), m3 = _mm_set1_pd(m[3]);
+    __m128d m4 = _mm_set1_pd(m[4]), m5 = _mm_set1_pd(m[5]);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(xs + i);
+        __m128d y = _mm_loadu_pd(ys + i);
+
+        __m128d tx =
+            _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, m0), _mm_mul_pd(y, m2)), m4);
+        __m128d ty =
+            _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, m1), _mm_mul_pd(y, m3)), m5);
+
+        _mm_storeu_pd(xs + i, tx);
+        _mm_storeu_pd(ys + i, ty);
+    }
+
+    return i;
 }
+#endif
+
+#ifdef HFA_HAVE_AVX2_DISPATCH
+__attribute__((target("avx2"))) static size_t
+affine_transform_avx2(double *xs, double *ys, size_t n, const double *m) {
+    __m256d m0 = _mm256_set1_pd(m[0]), m1 = _mm256_set1_pd(m[1]);
+    __m256d m2 = _mm256_set1_pd(m[2]), m3 = _mm256_set1_pd(m[3]);
+    __m256d m4 = _mm256_set1_pd(m[4]), m5 = _mm256_set1_pd(m[5]);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        __m256d y = _mm256_loadu_pd(ys + i);
+
+        __m256d tx = _mm256_add_pd(
+            _mm256_add_pd(_mm256_mul_pd(x, m0), _mm256_mul_pd(y, m2)), m4);
+        __m256d ty = _mm256_add_pd(
+            _mm256_add_pd(_mm256_mul_pd(x, m1), _mm256_mul_pd(y, m3)), m5);
+
+        _mm256_storeu_pd(xs + i, tx);
+        _mm256_storeu_pd(ys + i, ty);
+    }
+
+    return i;
+}
+#endif
 
 /*
- * rotate [utility]
+ * affine_transform [utility]
+ *
+ * apply an affine (xform layout) to points in place, using AVX2 when the CPU
+ * supports it, then SSE2, with a scalar loop for the remainder
  *
- * @return vector<pair<double, double>> orientated points
+ * @param xs	double*	x coordinates
+ * @param ys	double*	y coordinates
+ * @param n	size_t	number of points
+ * @param m	const double* 6 element affine
  */
-vector<pair<double, double>> rotate(vector<pair<double, double>> pts,
-                                    double *center, double orientation) {
-    vector<pair<double, double>> orientated;
+void affine_transform(double *xs, double *ys, size_t n, const double *m) {
+    size_t done = 0;
 
-    vector<pair<double, double>>::iterator it;
-    for (it = pts.begin(); it != pts.end(); it++) {
-        pair<double, double> vect_coord =
-            rotate(*it - center, orientation) + center;
-        orientated.push_back(vect_coord);
+#ifdef HFA_HAVE_AVX2_DISPATCH
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if (hasAVX2) {
+        done = affine_transform_avx2(xs, ys, n, m);
     }
+#endif
+#ifdef HFA_HAVE_SSE2
+    done += affine_transform_sse2(xs + done, ys + done, n - done, m);
+#endif
 
-    return orientated;
+    affine_transform_scalar(xs + done, ys + done, n - done, m);
 }
 
 /*
@@ -206,70 +317,151 @@ HFAField *get_field(HFAType *ntype, string tFieldName, GByte *&data,
 /*
  * get_matrix [utility]
  *
- * Extract BASEDATA matrix from HFAField
+ * Decode a BASEDATA matrix from HFAField into a caller-supplied buffer,
+ * snprintf style: the matrix is only decoded if it fits in mtxSize
  *
  * @param hf		HFAField*
  * @param data		GByte*
- * @param dataPos 	GInt32
  * @param dataSize	GInt32
+ * @param mtx		double* 1d (row major) buffer, may be NULL
+ * @param mtxSize	int capacity of mtx
  *
- * @return vector<double>  1d representation of BASEDATA matrix
+ * @return int  number of matrix elements, -1 if the field cannot be decoded
  */
-vector<double> get_matrix(HFAField *hf, GByte *data, GInt32 dataPos,
-                          GInt32 dataSize) {
-    GInt32 nRows, nColumns;
-    GInt16 nBaseItemType;
+int get_matrix(HFAField *hf, GByte *data, GInt32 dataSize, double *mtx,
+               int mtxSize) {
+    int nRows, nColumns;
 
-    // extract BASEDATA meta
-    memcpy(&nRows, data + 8, 4);
-    HFAStandard(4, &nRows);
-    memcpy(&nColumns, data + 12, 4);
-    HFAStandard(4, &nColumns);
-    memcpy(&nBaseItemType, data + 16, 2);
-    HFAStandard(2, &nBaseItemType);
+    if (!hf->ExtractBaseData(data, dataSize, &nRows, &nColumns, NULL, 0)) {
+        return -1;
+    }
 
-    vector<double> pts;
-    for (int idx = 0; idx < nColumns * nRows; idx++) {
-        double _val;
-        hf->ExtractInstValue(NULL, idx, data, dataPos, dataSize, 'd', &_val);
-        pts.push_back(_val);
+    int nValues = nRows * nColumns;
+    if (mtx != NULL && nValues <= mtxSize &&
+        !hf->ExtractBaseData(data, dataSize, &nRows, &nColumns, mtx,
+                             mtxSize)) {
+        return -1;
     }
 
-    return pts;
+    return nValues;
 }
 
+/************************************************************************/
+/*                                                                      */
+/*                             HFAEntryIndex                            */
+/*                                                                      */
+/************************************************************************/
+
+// entries a sparse index records, the SRS ones and the element lists
+static const char *const HFA_SPARSE_INDEX_NAMES[] = {
+    "Map_Info", "Projection", "Datum", "ElementList", NULL};
+
 /*
- * find [utility]
- *
- * Retrieve HFA node of specified name using recursive search
+ * Constructor for HFAEntryIndex
  *
- * @param node 	HFAEntry* start node
- * @param name  string target name
+ * - walks the tree once in pre-order (child subtree before next sibling)
+ * and records every entry under its name and type
+ * - a sparse index records only the entries named in HFA_SPARSE_INDEX_NAMES
+ * (no types), and does not walk below an ElementList, so the annotation
+ * entries are neither read nor indexed
  *
- * @return HFAEntry* HFAEntry of specified name
+ * @param root  	HFAEntry* root node
+ * @param sparse	bool
  */
-HFAEntry *find(HFAEntry *node, string name) {
-    if (node->GetName() == name) {
-        return node;
+HFAEntryIndex::HFAEntryIndex(HFAEntry *root, bool sparse) {
+    if (sparse) {
+        add_sparse(root);
+        return;
     }
 
-    HFAEntry *tgNode = NULL;
+    // ancestor chain, as (name, index of parent frame)
+    vector<pair<string, int>> frames;
+    // pending entries, as (entry, index of its parent frame)
+    vector<pair<HFAEntry *, int>> stack;
 
-    if (node->GetChild() != NULL) {
-        tgNode = find(node->GetChild(), name);
-        if (tgNode != NULL) {
-            return tgNode;
+    if (root != NULL) {
+        stack.push_back(make_pair(root, -1));
+    }
+
+    while (!stack.empty()) {
+        HFAEntry *node = stack.back().first;
+        int parentFrame = stack.back().second;
+        stack.pop_back();
+
+        string name = node->GetName();
+        byName[name].push_back(node);
+        byType[node->GetType()].push_back(node);
+
+        bool nested = false;
+        for (int f = parentFrame; f >= 0 && !nested; f = frames[f].second) {
+            nested = (frames[f].first == name);
+        }
+        if (!nested) {
+            outermostByName[name].push_back(node);
+        }
+
+        // next is pushed first so that the child subtree is visited first
+        if (node->GetNext() != NULL) {
+            stack.push_back(make_pair(node->GetNext(), parentFrame));
         }
+
+        if (node->GetChild() != NULL) {
+            frames.push_back(make_pair(name, parentFrame));
+            stack.push_back(make_pair(node->GetChild(), frames.size() - 1));
+        }
+    }
+}
+
+/*
+ * add_sparse
+ *
+ * - the sparse walk of the constructor
+ * - an ElementList found outside any other one is outermost by definition
+ *
+ * @param root  HFAEntry* root node
+ */
+void HFAEntryIndex::add_sparse(HFAEntry *root) {
+    vector<HFAEntry *> stack;
+    if (root != NULL) {
+        stack.push_back(root);
     }
 
-    if (node->GetNext() != NULL) {
-        tgNode = find(node->GetNext(), name);
-        if (tgNode != NULL) {
-            return tgNode;
+    while (!stack.empty()) {
+        HFAEntry *node = stack.back();
+        stack.pop_back();
+
+        const char *name = node->GetName();
+        bool elementList = false;
+        for (int i = 0; HFA_SPARSE_INDEX_NAMES[i] != NULL; i++) {
+            if (strcmp(name, HFA_SPARSE_INDEX_NAMES[i]) != 0) {
+                continue;
+            }
+
+            byName[name].push_back(node);
+            outermostByName[name].push_back(node);
+            elementList = (strcmp(name, "ElementList") == 0);
+            break;
+        }
+
+        // next is pushed first so that the child subtree is visited first
+        if (node->GetNext() != NULL) {
+            stack.push_back(node->GetNext());
+        }
+
+        if (!elementList && node->GetChild() != NULL) {
+            stack.push_back(node->GetChild());
         }
     }
+}
 
-    return NULL;
+const vector<HFAEntry *> &
+HFAEntryIndex::lookup(const unordered_map<string, vector<HFAEntry *>> &idx,
+                      const string &key) {
+    static const vector<HFAEntry *> none;
+
+    unordered_map<string, vector<HFAEntry *>>::const_iterator it =
+        idx.find(key);
+    return (it == idx.end()) ? none : it->second;
 }
 
 /************************************************************************/
@@ -282,39 +474,146 @@ HFAEntry *find(HFAEntry *node, string name) {
  * Constructor for HFAEllipse
  *
  */
-HFAEllipse::HFAEllipse(HFAEntry *node) {
-    center = new double[2];
-    center[0] = node->GetDoubleField("center.x");
-    center[1] = node->GetDoubleField("center.y");
+HFAEllipse::HFAEllipse(HFAEntry *node, HFACoordStore &store,
+                       const HFAEllipseFields &f)
+    : HFAGeom(store) {
+    center[0] = node->GetDoubleField(f.centerX);
+    center[1] = node->GetDoubleField(f.centerY);
+
+    rotation = node->GetDoubleField(f.orientation);
+
+    semiMajorAxis = node->GetDoubleField(f.semiMajorAxis);
+    semiMinorAxis = node->GetDoubleField(f.semiMinorAxis);
+
+    add_unorientated_pts();
+    rotation_xform(center, rotation, local);
+}
+
+/*
+ * unit_circle [utility]
+ *
+ * cos/sin of seg evenly spaced angles 2pi * (i + 1) / seg
+ *
+ * - tables are computed once per segment count and shared by every ellipse
+ * (and thread) for the rest of the run
+ *
+ * @param seg	int	number of segments
+ *
+ * @return const pair<vector<double>, vector<double>>&	{cos[], sin[]}
+ */
+static const pair<vector<double>, vector<double>> &unit_circle(int seg) {
+    static mutex tablesMutex;
+    static map<int, pair<vector<double>, vector<double>>> tables;
+
+    lock_guard<mutex> lock(tablesMutex);
+
+    map<int, pair<vector<double>, vector<double>>>::iterator it =
+        tables.find(seg);
+    if (it != tables.end()) {
+        return it->second;
+    }
+
+    pair<vector<double>, vector<double>> &table = tables[seg];
+    table.first.resize(seg);
+    table.second.resize(seg);
+    for (int i = 0; i < seg; i++) {
+        double theta = (2 * HFA_PI * (i + 1)) / seg;
+        table.first[i] = cos(theta);
+        table.second[i] = sin(theta);
+    }
+
+    return table;
+}
+
+/*
+ * get_num_segments
+ *
+ * - with an arc tolerance, the smallest segment count whose chord error
+ * (sagitta) on the larger axis stays within it: r * (1 - cos(pi / seg)) <= tol
+ * - otherwise grows with the square root of the mean axis
+ *
+ * @return int number of segments, at least 8
+ */
+int HFAEllipse::get_num_segments() const {
+    if (arcTolerance <= 0) {
+        return max(
+            (int)floor(sqrt(((semiMajorAxis + semiMinorAxis) / 2) * 20)), 8);
+    }
 
-    rotation = node->GetDoubleField("orientation");
+    double r = max(fabs(semiMajorAxis), fabs(semiMinorAxis));
+    if (r <= arcTolerance) {
+        return 8;
+    }
 
-    semiMajorAxis = node->GetDoubleField("semiMajorAxis");
-    semiMinorAxis = node->GetDoubleField("semiMinorAxis");
+    double seg = ceil(HFA_PI / acos(1.0 - arcTolerance / r));
+    return (int)min(max(seg, 8.0), (double)HFA_MAX_ARC_SEGMENTS);
 }
 
 /*
- * get_unorientated_pts
+ * get_arc_pts
+ *
+ * control points of the ellipse as a closed circular string of two arcs, in
+ * map space
+ *
+ * - circular arcs can only represent the ellipse exactly when it is a circle
+ * that stays a circle under m (rotation, uniform scale, reflection and
+ * translation), any other ellipse has to be densified
  *
- * - discretizes ellipse to polygon without rotation
+ * @param m	const double*	affine from shape to map space
+ * @param xs	double*		5 x coordinates
+ * @param ys	double*		5 y coordinates
+ *
+ * @return bool false if the ellipse is not a circle in map space
+ */
+bool HFAEllipse::get_arc_pts(const double *m, double *xs, double *ys) const {
+    const double eps = 1e-9;
+
+    double r = fabs(semiMajorAxis);
+    if (r == 0 || fabs(r - fabs(semiMinorAxis)) > eps * r) {
+        return false;
+    }
+
+    // columns of the linear part must be orthogonal and of equal length
+    double sqScale = m[0] * m[0] + m[1] * m[1];
+    if (sqScale == 0 ||
+        fabs(sqScale - (m[2] * m[2] + m[3] * m[3])) > eps * sqScale ||
+        fabs(m[0] * m[2] + m[1] * m[3]) > eps * sqScale) {
+        return false;
+    }
+
+    double cx = (center[0] * m[0] + center[1] * m[2]) + m[4];
+    double cy = (center[0] * m[1] + center[1] * m[3]) + m[5];
+    r *= sqrt(sqScale);
+
+    const double dx[5] = {1, 0, -1, 0, 1};
+    const double dy[5] = {0, 1, 0, -1, 0};
+    for (int i = 0; i < 5; i++) {
+        xs[i] = cx + r * dx[i];
+        ys[i] = cy + r * dy[i];
+    }
+
+    return true;
+}
+
+/*
+ * add_unorientated_pts
  *
- * @returns vector<pair<double, double>>
+ * - discretizes ellipse to polygon without rotation into the coordinate store
  */
-vector<pair<double, double>> HFAEllipse::get_unorientated_pts() const {
-    vector<pair<double, double>> pts;
+void HFAEllipse::add_unorientated_pts() {
+    size_t offset = store->size();
 
-    int seg =
-        max((int)floor(sqrt(((semiMajorAxis + semiMinorAxis) / 2) * 20)), 8);
-    double shift = (44 / 7.0f) / seg; // (44/7) -> approx of 2pi
-    double theta = 0.0;
+    int seg = get_num_segments();
+    const pair<vector<double>, vector<double>> &circle = unit_circle(seg);
     for (int i = 0; i < seg; ++i) {
-        theta += shift;
-        pts.push_back(make_pair(center[0] + (semiMajorAxis * cos(theta)),
-                                center[1] + (semiMinorAxis * sin(theta))));
+        store->push(center[0] + (semiMajorAxis * circle.first[i]),
+                    center[1] + (semiMinorAxis * circle.second[i]));
     }
-    pts.push_back(pts[0]);
+    span = store->span_from(offset);
 
-    return pts;
+    // close the ring
+    store->push(store->x_data(span)[0], store->y_data(span)[0]);
+    span.length++;
 }
 
 /************************************************************************/
@@ -327,43 +626,46 @@ vector<pair<double, double>> HFAEllipse::get_unorientated_pts() const {
  * Constructor for HFARectangle
  *
  */
-HFARectangle::HFARectangle(HFAEntry *node) {
-    center = new double[2];
-    center[0] = node->GetDoubleField("center.x");
-    center[1] = node->GetDoubleField("center.y");
+HFARectangle::HFARectangle(HFAEntry *node, HFACoordStore &store,
+                           const HFARectangleFields &f)
+    : HFAGeom(store) {
+    center[0] = node->GetDoubleField(f.centerX);
+    center[1] = node->GetDoubleField(f.centerY);
+
+    rotation = node->GetDoubleField(f.orientation);
 
-    rotation = node->GetDoubleField("orientation");
+    width = node->GetDoubleField(f.width);
+    height = node->GetDoubleField(f.height);
 
-    width = node->GetDoubleField("width");
-    height = node->GetDoubleField("height");
+    add_unorientated_pts();
+    rotation_xform(center, rotation, local);
 }
 
 /*
- * get_unorientated_points
+ * add_unorientated_pts
  *
- * - get the 4 unorientated corners of the rectangle
+ * - add the 4 unorientated corners of the rectangle to the coordinate store
  * - follows LinearRing coordinate standard (first and last coordinates are the
  * same)
- *
- * @return vector<pair<double, double>> four unorientated corners
  */
-vector<pair<double, double>> HFARectangle::get_unorientated_pts() const {
-    vector<pair<double, double>> pts;
+void HFARectangle::add_unorientated_pts() {
+    size_t offset = store->size();
 
     int ydir[2] = {1, -1};
     int xdir[2] = {-1, 1};
     for (int i = 0; i <= 1; i++) {
         for (int j = 0; j <= 1; j++) {
-            pts.push_back(make_pair(center[0] + (xdir[j] * (width / 2)),
-                                    center[1] + (ydir[i] * (height / 2))));
+            store->push(center[0] + (xdir[j] * (width / 2)),
+                        center[1] + (ydir[i] * (height / 2)));
         }
         int temp = xdir[1];
         xdir[1] = xdir[0];
         xdir[0] = temp;
     }
-    pts.push_back(pts[0]);
+    span = store->span_from(offset);
 
-    return pts;
+    store->push(store->x_data(span)[0], store->y_data(span)[0]);
+    span.length++;
 }
 
 /************************************************************************/
@@ -384,7 +686,8 @@ vector<pair<double, double>> HFARectangle::get_unorientated_pts() const {
  * shape: 3x2 (<BASEDATA nColumns> x <BASEDATA nRows>)
  *
  */
-HFAPolyline::HFAPolyline(HFAEntry *node) {
+HFAPolyline::HFAPolyline(HFAEntry *node, HFACoordStore &store)
+    : HFAGeom(store) {
     GByte *data = node->GetData();
     GInt32 dataPos = node->GetDataPos();
     GInt32 dataSize = node->GetDataSize();
@@ -397,10 +700,24 @@ HFAPolyline::HFAPolyline(HFAEntry *node) {
         get_field(polyCoords->poItemObjectType, HFA_POLYLINE_COORDS_ATTR_NAME,
                   data, dataPos, dataSize);
 
-    vector<double> coordsMtx = get_matrix(vectCoords, data, dataPos, dataSize);
-    for (int i = 0; i < coordsMtx.size(); i += 2) {
-        pts.push_back(make_pair(coordsMtx[i], coordsMtx[i + 1]));
+    size_t offset = store.size();
+    span = store.span_from(offset);
+
+    int nValues = get_matrix(vectCoords, data, dataSize, NULL, 0);
+    if (nValues <= 0) {
+        return;
+    }
+
+    // decode into the store's staging buffer and split into x[]/y[]
+    double *coordsMtx = store.get_scratch(nValues);
+    if (get_matrix(vectCoords, data, dataSize, coordsMtx, nValues) < 0) {
+        return;
     }
+
+    for (int i = 0; i + 1 < nValues; i += 2) {
+        store.push(coordsMtx[i], coordsMtx[i + 1]);
+    }
+    span = store.span_from(offset);
 }
 
 /************************************************************************/
@@ -413,12 +730,12 @@ HFAPolyline::HFAPolyline(HFAEntry *node) {
  * Constructor for HFAAnnotation
  *
  */
-HFAAnnotation::HFAAnnotation(HFAEntry *node) {
-    id = node->GetIntField("id");
-    name = node->GetStringField("name");
-    description = node->GetStringField("description");
-    elmType = node->GetStringField("elmType");
-    elmTypeId = node->GetIntField("elmType");
+HFAAnnotation::HFAAnnotation(HFAEntry *node, const HFAElementFields &f) {
+    id = node->GetIntField(f.id);
+    name = node->GetStringField(f.name);
+    description = node->GetStringField(f.description);
+    elmType = node->GetStringField(f.elmType);
+    elmTypeId = node->GetIntField(f.elmType);
 
     // get xform matrix
     GByte *data = node->GetData();
@@ -437,56 +754,75 @@ HFAAnnotation::HFAAnnotation(HFAEntry *node) {
     HFAField *polyVect =
         get_field(xformMatrix->poItemObjectType, HFA_XFORM_VECT_ATTR_NAME, data,
                   dataPos, dataSize);
-    vector<double> vects = get_matrix(polyVect, data, dataPos, dataSize);
+    int nVects = get_matrix(polyVect, data, dataSize, xform + 4, 2);
 
-    if (vects.size() == 2) {
-        xform[4] = vects[0];
-        xform[5] = vects[1];
-    } else {
-        Log(ERROR) << "unexpected xform.polycoefvect size of " << vects.size()
+    if (nVects != 2) {
+        Log(ERROR) << "unexpected xform.polycoefvect size of " << nVects
                    << " , expected 2";
     }
 
     HFAField *polyCoef =
         get_field(xformMatrix->poItemObjectType, HFA_XFORM_COEF_ATTR_NAME,
                   _data, _dataPos, _dataSize);
-    vector<double> coefs = get_matrix(polyCoef, _data, _dataPos, _dataSize);
+    int nCoefs = get_matrix(polyCoef, _data, _dataSize, xform, 4);
 
-    if (coefs.size() == 4) {
-        for (int i = 0; i < 4; i++) {
-            xform[i] = coefs[i];
-        }
-    } else {
-        Log(ERROR) << "unexpected xform.polycoefmtx size of " << coefs.size()
+    if (nCoefs != 4) {
+        Log(ERROR) << "unexpected xform.polycoefmtx size of " << nCoefs
                    << " , expected 4";
     }
 }
 
 /*
- * get_pts
+ * to_ogr
  *
- * apply transformation matrix on shape coordinates
+ * build the annotation shape as an OGRGeometry straight from the coordinate
+ * store, without a WKT round-trip
  *
- * [warning] only tested on Eant_Rectangle
+ * - with curves, circles are written exactly as a CURVEPOLYGON of a
+ * CIRCULARSTRING, other shapes (and ellipses) keep their densified points
  *
- * @return vector<pair<double, double>> transformed shape coordinates
+ * @param curves	bool	whether the output supports curve geometries
  *
+ * @return OGRGeometry* caller owned geometry, NULL if there are no points
  */
-vector<pair<double, double>> HFAAnnotation::get_pts() const {
-    vector<pair<double, double>> tCoords;
+OGRGeometry *HFAAnnotation::to_ogr(bool curves) const {
+    HFACoordView pts = get_pts();
+    if (pts.empty()) {
+        return NULL;
+    }
+
+    if (curves && elmTypeId == 14) {
+        HFAEllipse *ellipse = dynamic_cast<HFAEllipse *>(geom.get());
 
-    vector<pair<double, double>> geom_coords = geom->get_pts();
-    vector<pair<double, double>>::const_iterator it = geom_coords.begin();
-    for (; it != geom_coords.end(); it++) {
-        double tX =
-            ((*it).first * xform[0]) + ((*it).second * xform[2]) + xform[4];
-        double tY =
-            ((*it).first * xform[1]) + ((*it).second * xform[3]) + xform[5];
+        double m[6], xs[5], ys[5];
+        compose_xform(xform, geom->get_local_xform(), m);
+        if (ellipse != NULL && ellipse->get_arc_pts(m, xs, ys)) {
+            OGRCircularString *arcs = new OGRCircularString();
+            arcs->setPoints(5, xs, ys);
+
+            OGRCurvePolygon *poly = new OGRCurvePolygon();
+            poly->addRingDirectly(arcs);
+            return poly;
+        }
+    }
 
-        tCoords.push_back(make_pair(tX, tY));
+    switch (elmTypeId) {
+    case 10:
+        return new OGRPoint(pts.x(0), pts.y(0));
+    case 16: {
+        OGRLineString *line = new OGRLineString();
+        line->setPoints((int)pts.size(), pts.x_data(), pts.y_data());
+        return line;
     }
+    default: {
+        OGRLinearRing *ring = new OGRLinearRing();
+        ring->setPoints((int)pts.size(), pts.x_data(), pts.y_data());
 
-    return tCoords;
+        OGRPolygon *poly = new OGRPolygon();
+        poly->addRingDirectly(ring);
+        return poly;
+    }
+    }
 }
 
 /*
@@ -497,10 +833,10 @@ vector<pair<double, double>> HFAAnnotation::get_pts() const {
  */
 string HFAAnnotation::get_wkt() const {
     string wkt;
-    vector<pair<double, double>> geom_pts = get_pts();
+    HFACoordView geom_pts = get_pts();
     switch (elmTypeId) {
     case 10:
-        wkt = to_ptWKT(geom_pts[0].first, geom_pts[0].second);
+        wkt = to_ptWKT(geom_pts.x(0), geom_pts.y(0));
         break;
     case 16:
         wkt = to_linestrWKT(geom_pts);
@@ -536,6 +872,106 @@ bool _loadData(HFAEntry *hfaEntry) {
     return loaded;
 }
 
+/*
+ * walk_elements [utility]
+ *
+ * walks the subtree (node, its children and its siblings) in pre-order with
+ * an explicit stack, so stack depth does not grow with the number of elements
+ *
+ * @param node	  HFAEntry*	start node
+ * @param visit	  bool(HFAEntry*)	called on every node, the walk stops
+ * when it returns false
+ */
+template <typename Visit> static void walk_elements(HFAEntry *node,
+                                                    Visit visit) {
+    vector<HFAEntry *> stack;
+    stack.push_back(node);
+
+    while (!stack.empty()) {
+        node = stack.back();
+        stack.pop_back();
+
+        // read the links before visiting, the visitor may release the data
+        HFAEntry *next = node->GetNext();
+        HFAEntry *child = node->GetChild();
+
+        if (!visit(node)) {
+            return;
+        }
+
+        // next is pushed first so that the child subtree is visited first
+        if (next != NULL) {
+            stack.push_back(next);
+        }
+
+        if (child != NULL) {
+            stack.push_back(child);
+        }
+    }
+}
+
+/*
+ * extract_annotation [utility]
+ *
+ * decodes an annotation node (Element_X_Eant) and its shape, appending the
+ * shape's points to coords
+ *
+ * @param eant 	  HFAEntry*
+ * @param coords  HFACoordStore&
+ * @param fields  HFAEantFields&	field paths of the layer
+ *
+ * @return HFAAnnotation* caller owned, NULL if eant is not a supported
+ * annotation
+ */
+HFAAnnotation *extract_annotation(HFAEntry *eant, HFACoordStore &coords,
+                                  HFAEantFields &fields) {
+    if (!_loadData(eant)) {
+        return NULL;
+    }
+
+    const HFAElementFields &elmFields = fields.element.of(eant);
+    int elmType = eant->GetIntField(elmFields.elmType);
+    if (elmType == 0 || !geomFactory.supports(elmType)) {
+        return NULL;
+    }
+
+    HFAEntry *hfaAGeomChild = eant->GetChild();
+    if (hfaAGeomChild == NULL || !_loadData(hfaAGeomChild)) {
+        return NULL;
+    }
+
+    HFAAnnotation *hfaA = new HFAAnnotation(eant, elmFields);
+    hfaA->set_geom(
+        geomFactory.build(elmType, hfaAGeomChild, coords, fields));
+
+    return hfaA;
+}
+
+/*
+ * transform_annotation [utility]
+ *
+ * move an annotation's shape coordinates into map space
+ *
+ * - the shape's own rotation and the annotation's xform are fused into one
+ * affine, identity affines are skipped
+ *
+ * @param anno	  HFAAnnotation*
+ * @param coords  HFACoordStore&	store holding the shape's points
+ */
+static void transform_annotation(HFAAnnotation *anno, HFACoordStore &coords) {
+    HFAGeom *geom = anno->get_geom();
+    HFACoordSpan span = geom->get_span();
+
+    double m[6];
+    compose_xform(anno->get_xform(), geom->get_local_xform(), m);
+    if (span.length == 0 || is_identity_xform(m)) {
+        return;
+    }
+
+    affine_transform(coords.x_data(span), coords.y_data(span), span.length,
+                     m);
+}
+
 /*
  * extract_annotations [utility]
  *
@@ -546,51 +982,151 @@ bool _loadData(HFAEntry *hfaEntry) {
  * annotations
  * @param hfaal   HFAAnnotationLayer*		pointer to annotation layer
  * instance
+ * @param coords  HFACoordStore&		ref to annotation layer
+ * coordinate store
+ * @param fields  HFAEantFields&		field paths of the layer
  */
 void extract_annotations(HFAEntry *eant, vector<HFAAnnotation *> &annos,
-                         HFAAnnotationLayer *hfaal) {
-    if (_loadData(eant)) {
-        int elmType = eant->GetIntField("elmType");
-        if (elmType != 0 && geomFactory.supports(elmType)) {
-            HFAEntry *hfaAGeomChild = eant->GetChild();
-            if (_loadData(hfaAGeomChild)) {
-                HFAAnnotation *hfaA = new HFAAnnotation(eant);
-
-                HFAGeom *hfaAGeom = geomFactory.build(elmType, hfaAGeomChild);
-                hfaA->set_geom(hfaAGeom);
-
-                annos.push_back(hfaA);
-                hfaal->add_geomType(
-                    elmType); // add geomtype as metadata of a layer
-            }
+                         HFAAnnotationLayer *hfaal, HFACoordStore &coords,
+                         HFAEantFields &fields) {
+    walk_elements(eant, [&](HFAEntry *node) {
+        HFAAnnotation *hfaA = extract_annotation(node, coords, fields);
+        if (hfaA != NULL) {
+            annos.push_back(hfaA);
+            hfaal->add_geomType(
+                hfaA->get_typeId()); // add geomtype as metadata of a layer
         }
+        return true;
+    });
+}
+
+/*
+ * Constructor for HFAAnnotationLayer
+ *
+ * @param hHFA	HFAHandle
+ * @param load	bool	decode all annotations now, otherwise they are
+ * streamed on export (see stream)
+ */
+HFAAnnotationLayer::HFAAnnotationLayer(HFAHandle hHFA, bool load)
+    : hHFA(hHFA), root(hHFA->poRoot), index(hHFA->poRoot, !load),
+      loaded(load) {
+    hasSRS = extract_proj(hHFA, index, srs);
+
+    if (!loaded) {
+        return;
     }
 
-    if (eant->GetChild() != NULL) {
-        extract_annotations(eant->GetChild(), annos, hfaal);
+    // nested lists are covered by the walk of their outer list
+    const vector<HFAEntry *> &elmLists = index.find_outermost("ElementList");
+    for (size_t i = 0; i < elmLists.size(); i++) {
+        if (elmLists[i]->GetChild() != NULL) {
+            extract_annotations(elmLists[i]->GetChild(), annotations, this,
+                                coords, eantFields);
+        }
     }
 
-    if (eant->GetNext() != NULL) {
-        extract_annotations(eant->GetNext(), annos, hfaal);
+    if (annotations.empty()) {
+        Log(WARN) << "No annotation elements found";
     }
+
+    transform_coords();
 }
 
 /*
- * Constructor for HFAAnnotationLayer
+ * Destructor for HFAAnnotationLayer
  *
  */
-HFAAnnotationLayer::HFAAnnotationLayer(HFAHandle hHFA) {
-    hasSRS = extract_proj(hHFA, srs);
-    root = hHFA->poRoot;
+HFAAnnotationLayer::~HFAAnnotationLayer() {
+    vector<HFAAnnotation *>::const_iterator it;
+    for (it = annotations.begin(); it != annotations.end(); ++it) {
+        delete *it;
+    }
+}
 
-    HFAEntry *hfaElmList = find(root, "ElementList");
-    if (hfaElmList != NULL) {
-        extract_annotations(hfaElmList->GetChild(), annotations, this);
+/*
+ * transform_coords
+ *
+ * move every shape's coordinates into map space in a single pass over the
+ * coordinate store
+ */
+void HFAAnnotationLayer::transform_coords() {
+    vector<HFAAnnotation *>::const_iterator it;
+    for (it = annotations.begin(); it != annotations.end(); ++it) {
+        transform_annotation(*it, coords);
     }
+}
 
-    if (annotations.empty()) {
+/*
+ * stream
+ *
+ * decode annotations one at a time and hand each one to sink as soon as it
+ * is in map space, nothing is kept afterwards
+ *
+ * - memory stays bounded by the largest annotation: the coordinate store is
+ * cleared and every node's data is released once the walk moves on
+ *
+ * @param sink	HFAAnnotationSink&
+ *
+ * @return bool false if there are no annotations or sink failed
+ */
+bool HFAAnnotationLayer::stream(HFAAnnotationSink &sink) {
+    bool written = true;
+    int nAnnos = 0;
+
+    const vector<HFAEntry *> &elmLists = index.find_outermost("ElementList");
+    for (size_t i = 0; i < elmLists.size() && written; i++) {
+        if (elmLists[i]->GetChild() == NULL) {
+            continue;
+        }
+
+        walk_elements(elmLists[i]->GetChild(), [&](HFAEntry *node) {
+            HFAAnnotation *hfaA = extract_annotation(node, coords, eantFields);
+            if (hfaA != NULL) {
+                nAnnos++;
+                transform_annotation(hfaA, coords);
+                written = sink.write(*hfaA);
+
+                delete hfaA;
+                coords.clear();
+            }
+
+            // the shape node is a child, it is released when visited
+            node->ReleaseData();
+            return written;
+        });
+    }
+
+    if (nAnnos == 0) {
         Log(WARN) << "No annotation elements found";
+        return false;
     }
+
+    return written;
+}
+
+/*
+ * export_annos
+ *
+ * hand every annotation to sink, from memory if loaded otherwise streamed
+ * from the tree
+ *
+ * @param sink	HFAAnnotationSink&
+ *
+ * @return bool false if there are no annotations or sink failed
+ */
+bool HFAAnnotationLayer::export_annos(HFAAnnotationSink &sink) {
+    if (!loaded) {
+        return stream(sink);
+    }
+
+    vector<HFAAnnotation *>::const_iterator it;
+    for (it = annotations.begin(); it != annotations.end(); ++it) {
+        if (!sink.write(**it)) {
+            return false;
+        }
+    }
+
+    return !annotations.empty();
 }
 
 /*
@@ -637,32 +1173,43 @@ ostream &operator<<(ostream &os, const HFAAnnotationLayer &hal) {
  * */
 void HFAAnnotationLayer::display_HFATree(HFAEntry *node, int nIdent) {
     string _avoid = "StyleLibrary";
-    bool avoid = (node->GetName() == _avoid);
+    char indentSpaces[128];
 
-    static char indentSpaces[128];
-    for (int i = 0; i < nIdent; i++) {
-        indentSpaces[i] = ' ';
-    }
-    indentSpaces[nIdent] = '\0';
+    vector<pair<HFAEntry *, int>> stack;
+    stack.push_back(make_pair(node, nIdent));
 
-    fprintf(stdout, "%s%s(%s) @ %d + %d @ %d\n", indentSpaces, node->GetName(),
-            node->GetType(), node->GetFilePos(), node->GetDataSize(),
-            node->GetDataPos());
+    while (!stack.empty()) {
+        node = stack.back().first;
+        nIdent = stack.back().second;
+        stack.pop_back();
 
-    if (avoid) {
-        fprintf(stdout, "%s__omitted__\n\n", indentSpaces);
-    } else {
-        // field values
-        strcat(indentSpaces, "- ");
-        node->DumpFieldValues(stdout, indentSpaces);
-        fprintf(stdout, "\n");
-    }
+        bool avoid = (node->GetName() == _avoid);
 
-    if (node->GetChild() != NULL && (!avoid)) {
-        display_HFATree(node->GetChild(), nIdent + 1);
-    }
-    if (node->GetNext() != NULL) {
-        display_HFATree(node->GetNext(), nIdent);
+        for (int i = 0; i < nIdent; i++) {
+            indentSpaces[i] = ' ';
+        }
+        indentSpaces[nIdent] = '\0';
+
+        fprintf(stdout, "%s%s(%s) @ %d + %d @ %d\n", indentSpaces,
+                node->GetName(), node->GetType(), node->GetFilePos(),
+                node->GetDataSize(), node->GetDataPos());
+
+        if (avoid) {
+            fprintf(stdout, "%s__omitted__\n\n", indentSpaces);
+        } else {
+            // field values
+            strcat(indentSpaces, "- ");
+            node->DumpFieldValues(stdout, indentSpaces);
+            fprintf(stdout, "\n");
+        }
+
+        // next is pushed first so that the child subtree is displayed first
+        if (node->GetNext() != NULL) {
+            stack.push_back(make_pair(node->GetNext(), nIdent));
+        }
+        if (node->GetChild() != NULL && (!avoid)) {
+            stack.push_back(make_pair(node->GetChild(), nIdent + 1));
+        }
     }
 }
 
@@ -688,105 +1235,596 @@ void createOGRField(OGRLayer *layer, const char *fieldName,
     }
 }
 
+/************************************************************************/
+/*                                                                      */
+/*                             HFAOGRWriter                             */
+/*                                                                      */
+/************************************************************************/
+
 /*
- * write_to_shp
+ * Constructor for HFAOGRWriter
  *
- * - write/export HFAAnnotationLayer to ShapeFile (.shp)
+ * @param driver	GDALDriver*
+ * @param dst		fs::path	output path prefix, the geometry type
+ * name (HFA_DATASET_PER_TYPE) and ext are appended
+ * @param ext		const string&	file extension, e.g. ".shp"
+ * @param layout	HFAOGRLayout
+ * @param srs		OGRSpatialReference*	may be NULL
+ * @param layerOptions	const vector<string>&	layer creation options,
+ * NAME=VALUE
+ */
+HFAOGRWriter::HFAOGRWriter(GDALDriver *driver, fs::path dst, const string &ext,
+                           HFAOGRLayout layout, OGRSpatialReference *srs,
+                           const vector<string> &layerOptions)
+    : driver(driver), dst(dst), ext(ext), layout(layout), srs(srs),
+      layerOptions(layerOptions) {
+    // drivers without curve support (e.g. shapefiles) get densified ellipses
+    curves = driver->GetMetadataItem(GDAL_DCAP_CURVE_GEOMETRIES) != NULL;
+}
+
+/*
+ * create
  *
- * Caveats
- * - Setting the layer name does not work expected (layer name turns out to be
- * the base name of the output file name/path)
- * - Field width will be truncated to 254 when set to 256 (i guess the max field
- * width is 254)
+ * writer for an output format (-f), with that format's driver, layout,
+ * layer options and spatial index
  *
- * @param driverName	const char* 	GDAL vector driver name
- * @param ofilename	string		Output file name/path
+ * @param format	const string&	SHP, FlatGeobuf, GPKG or Parquet
+ * @param dst		fs::path	output path, the extension is appended
+ * @param srs		OGRSpatialReference*	may be NULL
+ * @param opts		const HFAOGROptions&	per format settings
  *
+ * @return HFAOGRWriter* NULL if the driver is not available
  */
-bool HFAAnnotationLayer::write_to_shp(const char *driverName, fs::path dst) {
+HFAOGRWriter *HFAOGRWriter::create(const string &format, fs::path dst,
+                                   OGRSpatialReference *srs,
+                                   const HFAOGROptions &opts) {
+    const char *driverName;
+    string ext;
+    HFAOGRLayout layout;
+    vector<string> layerOptions;
+    HFAOGRIndex index = HFA_INDEX_NONE;
+    if (format == "FlatGeobuf") {
+        driverName = "FlatGeobuf";
+        ext = ".fgb";
+        layout = HFA_SINGLE_LAYER;
+        // packed Hilbert R-tree, features are written in Hilbert order
+        layerOptions = {"SPATIAL_INDEX=YES"};
+    } else if (format == "GPKG") {
+        driverName = "GPKG";
+        ext = ".gpkg";
+        layout = HFA_LAYER_PER_TYPE;
+        // the R-trees are bulk loaded once all features are in
+        layerOptions = {"SPATIAL_INDEX=NO"};
+        index = HFA_INDEX_RTREE;
+    } else if (format == "Parquet") {
+        driverName = "Parquet";
+        ext = ".parquet";
+        layout = HFA_SINGLE_LAYER;
+        // GeoParquet with WKB geometries and bbox covering columns
+        layerOptions = {"GEOMETRY_ENCODING=WKB", "WRITE_COVERING_BBOX=YES",
+                        "ROW_GROUP_SIZE=" + to_string(opts.rowGroupSize),
+                        "COMPRESSION=" + opts.compression};
+    } else {
+        driverName = "ESRI Shapefile";
+        ext = ".shp";
+        layout = HFA_DATASET_PER_TYPE;
+        if (opts.spatialIndex) {
+            index = HFA_INDEX_QIX;
+        }
+    }
+
     GDALDriver *driver = GetGDALDriverManager()->GetDriverByName(driverName);
     if (driver == NULL) {
         Log(ERROR) << "Cannot find " << driverName << "driver";
-        return false;
+        return NULL;
+    }
+
+    HFAOGRWriter *writer =
+        new HFAOGRWriter(driver, dst, ext, layout, srs, layerOptions);
+    writer->set_index(index, opts.indexJobs);
+
+    // only GeoPackage is written in batches
+    if (format == "GPKG") {
+        writer->set_batch_size(opts.batchSize);
+    }
+
+    return writer;
+}
+
+/*
+ * get_layer
+ *
+ * - creates the dataset and layer of a geometry type on first use
+ * - a single layer has mixed geometries, with the type in an elmType field
+ *
+ * @param gTypeId	int	annotation geometry type
+ *
+ * @return OGRLayer* NULL if the dataset cannot be created
+ */
+OGRLayer *HFAOGRWriter::get_layer(int gTypeId) {
+    bool single = (layout == HFA_SINGLE_LAYER);
+    int key = layer_key(gTypeId);
+    int dsKey = dataset_key(gTypeId);
+
+    map<int, OGRLayer *>::const_iterator lIt = layers.find(key);
+    if (lIt != layers.end()) {
+        return lIt->second;
+    }
+
+    // failures are remembered too, so they are only reported once
+    layers[key] = NULL;
+
+    fs::path geom_dst = dst;
+    if (layout == HFA_DATASET_PER_TYPE) {
+        geom_dst += geomFactory.gTypeIdToStr(gTypeId);
     }
+    geom_dst += ext;
 
-    vector<GDALDataset *> gdalDatasets;
-    map<int, OGRLayer *> layers;
+    GDALDataset *ds;
+    map<int, GDALDataset *>::const_iterator dsIt = datasets.find(dsKey);
+    if (dsIt != datasets.end()) {
+        ds = dsIt->second;
 
-    for (set<int>::iterator gtIt = geomTypes.begin(); gtIt != geomTypes.end();
-         ++gtIt) {
-        fs::path geom_dst = dst;
-        geom_dst += geomFactory.gTypeIdToStr(*gtIt);
-        geom_dst += ".shp";
+        // layers are not created inside a batch
+        end_batch(dsKey);
+    } else {
+        error_code ec;
+        fs::create_directories(geom_dst.parent_path(), ec);
 
-        GDALDataset *ds = driver->Create(geom_dst.string().c_str(), 0, 0, 0,
-                                         GDT_Unknown, NULL);
+        ds = driver->Create(geom_dst.string().c_str(), 0, 0, 0, GDT_Unknown,
+                            NULL);
         if (ds == NULL) {
             Log(ERROR) << "Unable to create file " << geom_dst;
-            continue;
+            return NULL;
         }
+        datasets[dsKey] = ds;
+    }
 
-        OGRLayer *l;
-        OGRwkbGeometryType lgeomType;
+    string layerName;
+    if (single) {
+        layerName = dst.filename().string();
+    } else if (layout == HFA_LAYER_PER_TYPE) {
+        layerName = geomFactory.gTypeIdToStr(gTypeId);
+    }
 
-        if ((*gtIt) == 10) {
-            lgeomType = wkbPoint;
-        } else if ((*gtIt) == 16) {
-            lgeomType = wkbLineString;
-        } else {
-            lgeomType = wkbPolygon;
-        }
+    OGRwkbGeometryType lgeomType;
+    if (single) {
+        lgeomType = wkbUnknown;
+    } else if (gTypeId == 10) {
+        lgeomType = wkbPoint;
+    } else if (gTypeId == 16) {
+        lgeomType = wkbLineString;
+    } else if (gTypeId == 14 && curves) {
+        lgeomType = wkbCurvePolygon;
+    } else {
+        lgeomType = wkbPolygon;
+    }
+
+    // NULL terminated, as CSL lists are
+    vector<char *> options;
+    for (string &option : layerOptions) {
+        options.push_back(&option[0]);
+    }
+    options.push_back(NULL);
+
+    // the driver keeps its own reference to srs
+    OGRLayer *l =
+        ds->CreateLayer(layerName.empty() ? NULL : layerName.c_str(), srs,
+                        lgeomType, options.data());
+    if (l == NULL) {
+        Log(ERROR) << "Unable to create layer in " << geom_dst;
+        return NULL;
+    }
+
+    createOGRField(l, "eleId", OFTInteger64);
+    createOGRField(l, "name", OFTString);
+    createOGRField(l, "desc", OFTString);
+
+    if (single) {
+        createOGRField(l, "elmType", OFTString);
+    }
+
+    if (single || gTypeId == 10) {
+        createOGRField(l, "text", OFTString);
+    }
+
+    if (sourceField) {
+        createOGRField(l, "source", OFTString);
+    }
+
+    layers[key] = l;
+    return l;
+}
+
+/*
+ * write
+ *
+ * write an annotation as a feature of its geometry type's layer
+ *
+ * @param anno	HFAAnnotation&
+ *
+ * @return bool
+ */
+bool HFAOGRWriter::write(HFAAnnotation &anno) {
+    OGRLayer *layer = get_layer(anno.get_typeId());
+    if (layer == NULL) {
+        return false;
+    }
+
+    int dsKey = dataset_key(anno.get_typeId());
+    begin_batch(dsKey);
+
+    OGRFeature *feat = OGRFeature::CreateFeature(layer->GetLayerDefn());
+    feat->SetField("eleId", anno.get_id());
+    feat->SetField("name", anno.get_name());
+    feat->SetField("desc", anno.get_desc());
+
+    if (layout == HFA_SINGLE_LAYER) {
+        feat->SetField("elmType", anno.get_type());
+    }
+
+    if (anno.get_typeId() == 10) {
+        HFAText *hfaText = dynamic_cast<HFAText *>(anno.get_geom());
+        feat->SetField("text", hfaText->get_text());
+    }
+
+    if (sourceField) {
+        feat->SetField("source", source.c_str());
+    }
+
+    // the feature takes ownership of the geometry
+    feat->SetGeometryDirectly(anno.to_ogr(curves));
+
+    bool created = layer->CreateFeature(feat) == OGRERR_NONE;
+    if (!created) {
+        Log(ERROR) << "Failed to create feature in "
+                   << driver->GetDescription();
+    }
+
+    OGRFeature::DestroyFeature(feat);
+
+    map<int, int>::iterator bIt = batched.find(dsKey);
+    if (bIt != batched.end() && ++bIt->second >= batchSize) {
+        end_batch(dsKey);
+    }
+
+    return created && !failed;
+}
+
+/*
+ * begin_batch
+ *
+ * open a transaction on a dataset unless one is open already
+ *
+ * - drivers without transactions (e.g. shapefiles) are left as they are
+ *
+ * @param dsKey	int	dataset key
+ */
+void HFAOGRWriter::begin_batch(int dsKey) {
+    if (batchSize <= 0 || batched.count(dsKey)) {
+        return;
+    }
+
+    if (datasets[dsKey]->StartTransaction() != OGRERR_NONE) {
+        Log(WARN) << driver->GetDescription()
+                  << " does not support transactions, writing unbatched";
+        batchSize = 0;
+        return;
+    }
+
+    batched[dsKey] = 0;
+}
+
+/*
+ * end_batch
+ *
+ * commit the open transaction of a dataset, if any
+ *
+ * @param dsKey	int	dataset key
+ */
+void HFAOGRWriter::end_batch(int dsKey) {
+    map<int, int>::iterator bIt = batched.find(dsKey);
+    if (bIt == batched.end()) {
+        return;
+    }
+    batched.erase(bIt);
 
-        l = ds->CreateLayer(
-            NULL,
-            ((hasSRS == false) ? NULL : new OGRSpatialReference(get_srs())),
-            lgeomType, NULL);
+    if (datasets[dsKey]->CommitTransaction() != OGRERR_NONE) {
+        Log(ERROR) << "Failed to commit features to "
+                   << driver->GetDescription();
+        failed = true;
+    }
+}
 
-        createOGRField(l, "eleId", OFTInteger64);
-        createOGRField(l, "name", OFTString);
-        createOGRField(l, "desc", OFTString);
+/*
+ * build_indexes
+ *
+ * build the spatial index of every layer from the finished data
+ *
+ * - datasets are independent files, so up to indexJobs threads index one
+ * dataset at a time each, otherwise they are indexed one after another
+ *
+ */
+void HFAOGRWriter::build_indexes() {
+    // statements per dataset
+    map<int, vector<string>> stmts;
 
-        if ((*gtIt) == 10) {
-            createOGRField(l, "text", OFTString);
+    map<int, OGRLayer *>::const_iterator lIt;
+    for (lIt = layers.begin(); lIt != layers.end(); ++lIt) {
+        if (lIt->second == NULL) {
+            continue;
         }
 
-        layers.insert(make_pair((*gtIt), l));
-        gdalDatasets.push_back(ds);
+        string sql;
+        if (index == HFA_INDEX_RTREE) {
+            sql = string("SELECT CreateSpatialIndex('") +
+                  lIt->second->GetName() + "', '" +
+                  lIt->second->GetGeometryColumn() + "')";
+        } else {
+            sql = string("CREATE SPATIAL INDEX ON \"") +
+                  lIt->second->GetName() + "\"";
+        }
+        stmts[dataset_key(lIt->first)].push_back(sql);
     }
 
-    vector<HFAAnnotation *>::const_iterator it;
-    for (it = annotations.begin(); it != annotations.end(); ++it) {
-        OGRFeature *feat;
-        OGRGeometry *geom;
+    // ExecuteSQL() only reports errors through the CPL error state, which is
+    // per thread
+    string src = CURRSRC;
+    auto index_dataset = [&](GDALDataset *ds, const vector<string> &sqls,
+                             int &ok) {
+        CURRSRC = src;
+        ok = TRUE;
+        for (size_t i = 0; i < sqls.size(); i++) {
+            CPLErrorReset();
+            OGRLayer *res = ds->ExecuteSQL(sqls[i].c_str(), NULL, NULL);
+            if (res != NULL) {
+                ds->ReleaseResultSet(res);
+            }
+            if (CPLGetLastErrorType() == CE_Failure) {
+                Log(ERROR) << "Failed to build spatial index of "
+                           << ds->GetDescription() << ": "
+                           << CPLGetLastErrorMsg();
+                ok = FALSE;
+            }
+        }
+    };
 
-        feat = OGRFeature::CreateFeature(
-            layers[(*it)->get_typeId()]->GetLayerDefn());
-        feat->SetField("eleId", (*it)->get_id());
-        feat->SetField("name", (*it)->get_name());
-        feat->SetField("desc", (*it)->get_desc());
+    vector<pair<GDALDataset *, const vector<string> *>> queue;
+    map<int, vector<string>>::const_iterator sIt;
+    for (sIt = stmts.begin(); sIt != stmts.end(); ++sIt) {
+        queue.push_back(make_pair(datasets[sIt->first], &sIt->second));
+    }
 
-        HFAGeom *hfaGeom = (*it)->get_geom();
+    // one result per dataset, written by the thread that indexed it
+    vector<int> results(queue.size(), TRUE);
+
+    size_t next = 0;
+    mutex nextLock;
+    auto index_queue = [&]() {
+        for (;;) {
+            size_t i;
+            {
+                lock_guard<mutex> guard(nextLock);
+                if (next == queue.size()) {
+                    return;
+                }
+                i = next++;
+            }
+            index_dataset(queue[i].first, *queue[i].second, results[i]);
+        }
+    };
 
-        if ((*it)->get_typeId() == 10) {
-            HFAText *hfaText = dynamic_cast<HFAText *>(hfaGeom);
-            feat->SetField("text", hfaText->get_text());
+    size_t nThreads = min(queue.size(), (size_t)max(indexJobs, 1));
+    if (nThreads <= 1) {
+        index_queue();
+    } else {
+        vector<thread> indexers;
+        for (size_t t = 0; t < nThreads; t++) {
+            indexers.push_back(thread(index_queue));
         }
 
-        string wktStr = (*it)->get_wkt();
-        OGRGeometryFactory::createFromWkt(wktStr.c_str(), NULL, &geom);
-        feat->SetGeometry(geom);
+        for (size_t t = 0; t < indexers.size(); t++) {
+            indexers[t].join();
+        }
+    }
 
-        if (layers[(*it)->get_typeId()]->CreateFeature(feat) != OGRERR_NONE) {
-            Log(ERROR) << "Failed to create feature in Shapefile";
-            return false;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (!results[i]) {
+            failed = true;
         }
+    }
+}
+
+/*
+ * close
+ *
+ * commit, build deferred spatial indexes and close every dataset, the
+ * writer can not be used afterwards
+ *
+ * @return bool false if a batch could not be committed or an index could
+ * not be built
+ */
+bool HFAOGRWriter::close() {
+    map<int, GDALDataset *>::iterator it;
+    for (it = datasets.begin(); it != datasets.end(); ++it) {
+        end_batch(it->first);
+    }
+
+    if (index != HFA_INDEX_NONE) {
+        build_indexes();
+    }
 
-        OGRFeature::DestroyFeature(feat);
+    for (it = datasets.begin(); it != datasets.end(); ++it) {
+        GDALClose(it->second);
     }
 
-    for (int dsIdx = 0; dsIdx < gdalDatasets.size(); dsIdx++) {
-        GDALClose(gdalDatasets[dsIdx]);
+    datasets.clear();
+    layers.clear();
+
+    return !failed;
+}
+
+/*
+ * write_to_ogr
+ *
+ * - write/export HFAAnnotationLayer through a GDAL vector driver, e.g. to
+ * ShapeFiles (.shp), one per geometry type
+ *
+ * Caveats
+ * - Setting the layer name does not work expected (layer name turns out to be
+ * the base name of the output file name/path)
+ * - Field width will be truncated to 254 when set to 256 (i guess the max field
+ * width is 254)
+ *
+ * @param format	const string&	output format, see HFAOGRWriter::create
+ * @param dst		fs::path	Output file name/path prefix
+ * @param opts		const HFAOGROptions&	per format settings
+ *
+ */
+bool HFAAnnotationLayer::write_to_ogr(const string &format, fs::path dst,
+                                      const HFAOGROptions &opts) {
+    unique_ptr<HFAOGRWriter> writer(
+        HFAOGRWriter::create(format, dst, hasSRS ? &srs : NULL, opts));
+    if (writer == NULL) {
+        return false;
     }
 
+    bool written = export_annos(*writer);
+
+    return writer->close() && written;
+}
+
+
+/************************************************************************/
+/*                                                                      */
+/*                           HFAMergeWriter                             */
+/*                                                                      */
+/************************************************************************/
+
+/*
+ * srs_to_wkt [utility]
+ *
+ * @return string WKT of srs, empty if it has none
+ */
+static string srs_to_wkt(const OGRSpatialReference &srs) {
+    char *wkt = NULL;
+    srs.exportToWkt(&wkt);
+
+    string res = wkt ? wkt : "";
+    CPLFree(wkt);
+
+    return res;
+}
+
+/*
+ * HFAMergeSource
+ *
+ * sink of one source, forwards its annotations to the shared writer
+ *
+ */
+class HFAMergeSource : public HFAAnnotationSink {
+    HFAMergeWriter &merge;
+    const string &source;
+
+  public:
+    HFAMergeSource(HFAMergeWriter &merge, const string &source)
+        : merge(merge), source(source) {}
+
+    bool write(HFAAnnotation &anno) { return merge.write(anno, source); }
+};
+
+/*
+ * open
+ *
+ * create the shared writer with the SRS of the first source, called with
+ * the lock held
+ *
+ * @param layer	HFAAnnotationLayer&	first source
+ *
+ * @return bool
+ */
+bool HFAMergeWriter::open(HFAAnnotationLayer &layer) {
+    opened = true;
+
+    hasSRS = layer.has_srs();
+    if (hasSRS) {
+        srs = layer.get_srs();
+        srsWkt = srs_to_wkt(srs);
+    }
+
+    writer.reset(
+        HFAOGRWriter::create(format, dst, hasSRS ? &srs : NULL, opts));
+    if (writer == NULL) {
+        return false;
+    }
+
+    writer->set_source_field(true);
     return true;
 }
+
+/*
+ * add
+ *
+ * append the annotations of a source
+ *
+ * - the output has a single SRS, sources in another SRS are merged with
+ * their coordinates as is and a warning
+ *
+ * @param layer		HFAAnnotationLayer&
+ * @param source	const string&	value of the source field
+ *
+ * @return bool
+ */
+bool HFAMergeWriter::add(HFAAnnotationLayer &layer, const string &source) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (!opened) {
+            open(layer);
+        } else if (layer.has_srs() != hasSRS ||
+                   (hasSRS && srs_to_wkt(layer.get_srs()) != srsWkt)) {
+            Log(WARN) << "SRS differs from the first merged source, "
+                         "coordinates are merged as is";
+        }
+
+        if (writer == NULL) {
+            return false;
+        }
+    }
+
+    HFAMergeSource sink(*this, source);
+    return layer.export_annos(sink);
+}
+
+/*
+ * write
+ *
+ * write an annotation of source, features of concurrent sources are
+ * interleaved one at a time
+ *
+ * @return bool
+ */
+bool HFAMergeWriter::write(HFAAnnotation &anno, const string &source) {
+    lock_guard<mutex> guard(lock);
+    writer->set_source(source);
+
+    return writer->write(anno);
+}
+
+/*
+ * close
+ *
+ * build the spatial indexes and close the shared writer
+ *
+ * @return bool false if nothing could be written, or a batch failed
+ */
+bool HFAMergeWriter::close() {
+    lock_guard<mutex> guard(lock);
+    if (writer == NULL) {
+        return !opened;
+    }
+
+    bool closed = writer->close();
+    writer.reset();
+
+    return closed;
+}
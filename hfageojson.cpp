@@ -0,0 +1,470 @@
+#include <charconv>
+
+#include "ovr2shp.h"
+
+using namespace std;
+
+// flushed to disk whenever full
+static const size_t HFA_GEOJSON_BUFFER_SIZE = 1 << 20;
+
+// longest fixed notation double: sign, 309 integer digits, point, decimals
+static const size_t HFA_GEOJSON_MAX_DOUBLE = 352;
+
+// RFC 8142 record separator
+static const char HFA_GEOJSON_RS = 0x1E;
+
+/************************************************************************/
+/*                                                                      */
+/*                           HFAGeoJSONWriter                           */
+/*                                                                      */
+/************************************************************************/
+
+/*
+ * Constructor for HFAGeoJSONWriter
+ *
+ * - the file is only created once the first annotation is written
+ * - coordinates are reprojected to WGS84 longitude/latitude as RFC 7946
+ * requires, a layer without SRS can not be written that way
+ * - with sourceCRS they are kept in the layer's SRS instead, which is named
+ * in the legacy (2008) crs member
+ *
+ * @param dst		fs::path	output file
+ * @param seq		bool		GeoJSON text sequence instead of a
+ * FeatureCollection
+ * @param precision	int		digits after the decimal point, < 0 for
+ * the shortest representation that round-trips
+ * @param srs		OGRSpatialReference*	layer SRS, may be NULL
+ * @param sourceCRS	bool		keep the source coordinates
+ */
+HFAGeoJSONWriter::HFAGeoJSONWriter(fs::path dst, bool seq, int precision,
+                                   OGRSpatialReference *srs, bool sourceCRS)
+    : dst(dst), seq(seq), precision(precision) {
+    buf.resize(HFA_GEOJSON_BUFFER_SIZE);
+
+    if (sourceCRS) {
+        if (srs == NULL) {
+            return;
+        }
+
+        OGRSpatialReference ident(*srs);
+        ident.AutoIdentifyEPSG();
+        const char *auth = ident.GetAuthorityName(NULL);
+        const char *code = ident.GetAuthorityCode(NULL);
+        if (auth != NULL && code != NULL) {
+            crsName = string("urn:ogc:def:crs:") + auth + "::" + code;
+        } else {
+            Log(WARN) << "SRS has no authority code, GeoJSON is written "
+                         "without a crs member";
+        }
+        return;
+    }
+
+    if (srs == NULL) {
+        Log(ERROR) << "No SRS to reproject GeoJSON to WGS84 from, set one "
+                      "with -srs or keep the source coordinates with "
+                      "-source-crs";
+        failed = true;
+        return;
+    }
+
+    OGRSpatialReference source(*srs);
+    OGRSpatialReference wgs84;
+    wgs84.SetWellKnownGeogCS("WGS84");
+#if GDAL_VERSION_MAJOR >= 3
+    // x is easting/longitude on both sides, whatever the authority says
+    source.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    wgs84.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+#endif
+
+    ct = OGRCreateCoordinateTransformation(&source, &wgs84);
+    if (ct == NULL) {
+        Log(ERROR) << "Unable to reproject GeoJSON from the layer SRS to "
+                      "WGS84";
+        failed = true;
+    }
+}
+
+HFAGeoJSONWriter::~HFAGeoJSONWriter() {
+    close();
+
+    if (ct != NULL) {
+        OGRCoordinateTransformation::DestroyCT(ct);
+    }
+}
+
+/*
+ * open
+ *
+ * create the file and write the FeatureCollection header
+ *
+ * @return bool
+ */
+bool HFAGeoJSONWriter::open() {
+    error_code ec;
+    fs::create_directories(dst.parent_path(), ec);
+
+    fp = fopen(dst.string().c_str(), "wb");
+    if (fp == NULL) {
+        Log(ERROR) << "Unable to create file " << dst;
+        failed = true;
+        return false;
+    }
+
+    if (!seq) {
+        put("{\"type\":\"FeatureCollection\",");
+        put_crs();
+        put("\"features\":[\n");
+    }
+
+    return true;
+}
+
+/*
+ * put_crs
+ *
+ * append the legacy crs member and its comma, if there is one
+ */
+void HFAGeoJSONWriter::put_crs() {
+    if (crsName.empty()) {
+        return;
+    }
+
+    put("\"crs\":{\"type\":\"name\",\"properties\":{\"name\":");
+    put_string(crsName.c_str());
+    put("}},");
+}
+
+/*
+ * project
+ *
+ * @param pts	const HFACoordView&	points in the layer SRS
+ *
+ * @return HFACoordView pts in the output SRS, valid until the next call
+ */
+HFACoordView HFAGeoJSONWriter::project(const HFACoordView &pts) {
+    if (ct == NULL || pts.empty()) {
+        return pts;
+    }
+
+    xs.assign(pts.x_data(), pts.x_data() + pts.size());
+    ys.assign(pts.y_data(), pts.y_data() + pts.size());
+    if (!ct->Transform(pts.size(), xs.data(), ys.data())) {
+        Log(ERROR) << "Failed to reproject coordinates to WGS84";
+        failed = true;
+    }
+
+    return HFACoordView(xs.data(), ys.data(), pts.size());
+}
+
+/*
+ * flush
+ *
+ * write out the buffered bytes
+ *
+ * @return bool
+ */
+bool HFAGeoJSONWriter::flush() {
+    if (used > 0 && !failed && fwrite(buf.data(), 1, used, fp) != used) {
+        Log(ERROR) << "Failed to write " << dst;
+        failed = true;
+    }
+
+    used = 0;
+    return !failed;
+}
+
+/*
+ * reserve
+ *
+ * @param n	size_t	bytes about to be written, at most the buffer size
+ *
+ * @return char* where the next n bytes go, the caller advances used
+ */
+char *HFAGeoJSONWriter::reserve(size_t n) {
+    if (used + n > buf.size()) {
+        flush();
+    }
+
+    return buf.data() + used;
+}
+
+/*
+ * put
+ *
+ * append raw bytes
+ */
+void HFAGeoJSONWriter::put(const char *s, size_t n) {
+    while (n > 0) {
+        if (used == buf.size()) {
+            flush();
+        }
+
+        size_t chunk = min(n, buf.size() - used);
+        memcpy(buf.data() + used, s, chunk);
+        used += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+/*
+ * put_int
+ *
+ * append an integer
+ */
+void HFAGeoJSONWriter::put_int(long long val) {
+    char *p = reserve(24);
+    used += to_chars(p, p + 24, val).ptr - p;
+}
+
+/*
+ * put_double
+ *
+ * append a number, NaN and infinities have no JSON representation and are
+ * written as null
+ */
+void HFAGeoJSONWriter::put_double(double val) {
+    if (!isfinite(val)) {
+        put("null", 4);
+        return;
+    }
+
+    char *p = reserve(HFA_GEOJSON_MAX_DOUBLE);
+    char *end = p + HFA_GEOJSON_MAX_DOUBLE;
+    to_chars_result res = (precision < 0)
+                              ? to_chars(p, end, val)
+                              : to_chars(p, end, val, chars_format::fixed,
+                                         precision);
+    used += res.ptr - p;
+}
+
+/*
+ * put_string
+ *
+ * append a quoted JSON string, or null
+ *
+ * - HFA strings carry no encoding: valid UTF-8 is copied, any other byte is
+ * taken as Latin-1 and re-encoded, so the output is always valid UTF-8
+ *
+ * @param s	const char*	may be NULL
+ */
+void HFAGeoJSONWriter::put_string(const char *s) {
+    if (s == NULL) {
+        put("null", 4);
+        return;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+
+    put("\"", 1);
+
+    const unsigned char *run = (const unsigned char *)s;
+    const unsigned char *c = run;
+    while (*c != '\0') {
+        int nBytes = 1;
+        if (*c >= 0x80) {
+            // length of a well formed UTF-8 sequence starting at c, else 0
+            nBytes = (*c >= 0xC2 && *c <= 0xDF)   ? 2
+                     : (*c >= 0xE0 && *c <= 0xEF) ? 3
+                     : (*c >= 0xF0 && *c <= 0xF4) ? 4
+                                                  : 0;
+            for (int i = 1; i < nBytes; i++) {
+                if ((c[i] & 0xC0) != 0x80) {
+                    nBytes = 0;
+                    break;
+                }
+            }
+        } else if (*c >= 0x20 && *c != '"' && *c != '\\') {
+            c++;
+            continue;
+        }
+
+        if (nBytes > 1) {
+            c += nBytes;
+            continue;
+        }
+
+        // flush the plain run, then write c escaped or re-encoded
+        put((const char *)run, c - run);
+
+        char *p = reserve(6);
+        if (*c >= 0x80) {
+            p[0] = (char)(0xC0 | (*c >> 6));
+            p[1] = (char)(0x80 | (*c & 0x3F));
+            used += 2;
+        } else if (*c == '"' || *c == '\\') {
+            p[0] = '\\';
+            p[1] = (char)*c;
+            used += 2;
+        } else {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[*c >> 4];
+            p[5] = hex[*c & 0xF];
+            used += 6;
+        }
+
+        run = ++c;
+    }
+
+    put((const char *)run, c - run);
+    put("\"", 1);
+}
+
+/*
+ * put_point
+ *
+ * append [x,y]
+ */
+void HFAGeoJSONWriter::put_point(double x, double y) {
+    put("[", 1);
+    put_double(x);
+    put(",", 1);
+    put_double(y);
+    put("]", 1);
+}
+
+/*
+ * put_points
+ *
+ * append [[x,y],...]
+ */
+void HFAGeoJSONWriter::put_points(const HFACoordView &pts) {
+    put("[", 1);
+    for (size_t i = 0; i < pts.size(); i++) {
+        if (i > 0) {
+            put(",", 1);
+        }
+        put_point(pts.x(i), pts.y(i));
+    }
+    put("]", 1);
+}
+
+/*
+ * write
+ *
+ * write an annotation as a feature
+ *
+ * - ellipses are written densified, GeoJSON has no curve geometries
+ *
+ * @param anno	HFAAnnotation&
+ *
+ * @return bool
+ */
+bool HFAGeoJSONWriter::write(HFAAnnotation &anno) {
+    if (failed || (fp == NULL && !open())) {
+        return false;
+    }
+
+    if (seq) {
+        put(&HFA_GEOJSON_RS, 1);
+    } else if (nFeatures > 0) {
+        put(",\n", 2);
+    }
+
+    put("{\"type\":\"Feature\",");
+
+    // each record of a sequence stands alone
+    if (seq) {
+        put_crs();
+    }
+
+    put("\"properties\":{\"eleId\":");
+    put_int(anno.get_id());
+    put(",\"name\":");
+    put_string(anno.get_name());
+    put(",\"desc\":");
+    put_string(anno.get_desc());
+    put(",\"elmType\":");
+    put_string(anno.get_type());
+
+    if (anno.get_typeId() == 10) {
+        HFAText *hfaText = dynamic_cast<HFAText *>(anno.get_geom());
+        put(",\"text\":");
+        put_string(hfaText->get_text());
+    }
+
+    put("},\"geometry\":");
+
+    HFACoordView pts = project(anno.get_pts());
+    if (pts.empty()) {
+        put("null");
+    } else if (anno.get_typeId() == 10) {
+        put("{\"type\":\"Point\",\"coordinates\":");
+        put_point(pts.x(0), pts.y(0));
+        put("}");
+    } else if (anno.get_typeId() == 16) {
+        put("{\"type\":\"LineString\",\"coordinates\":");
+        put_points(pts);
+        put("}");
+    } else {
+        put("{\"type\":\"Polygon\",\"coordinates\":[");
+        put_points(pts);
+        put("]}");
+    }
+
+    put("}");
+    if (seq) {
+        put("\n", 1);
+    }
+
+    nFeatures++;
+    return !failed;
+}
+
+/*
+ * close
+ *
+ * finish the FeatureCollection and close the file
+ *
+ * @return bool false if anything failed to be written
+ */
+bool HFAGeoJSONWriter::close() {
+    if (fp == NULL) {
+        return !failed;
+    }
+
+    if (!seq) {
+        put("\n]}\n");
+    }
+
+    flush();
+    if (fclose(fp) != 0 && !failed) {
+        Log(ERROR) << "Failed to write " << dst;
+        failed = true;
+    }
+    fp = NULL;
+
+    return !failed;
+}
+
+/************************************************************************/
+/*                                                                      */
+/*                           HFAAnnotationLayer                         */
+/*                                                                      */
+/************************************************************************/
+
+/*
+ * to_gjson
+ *
+ * - write/export HFAAnnotationLayer to a single GeoJSON (.geojson) or
+ * GeoJSON text sequence (.geojsons) file holding every geometry type
+ *
+ * @param dst		fs::path	output path, the extension is appended
+ * @param seq		bool		GeoJSON text sequence (RFC 8142)
+ * @param precision	int		digits after the decimal point, < 0 for
+ * shortest round-trip
+ * @param sourceCRS	bool		keep the source SRS (legacy crs member)
+ * instead of reprojecting to WGS84
+ *
+ * @return bool
+ */
+bool HFAAnnotationLayer::to_gjson(fs::path dst, bool seq, int precision,
+                                  bool sourceCRS) {
+    dst += seq ? ".geojsons" : ".geojson";
+
+    HFAGeoJSONWriter writer(dst, seq, precision, hasSRS ? &srs : NULL,
+                            sourceCRS);
+    bool written = export_annos(writer);
+
+    return writer.close() && written;
+}
@@ -12,13 +12,14 @@ using namespace std;
  * - The above applies to HFAGetProParameters & HFAGetDatum
  *
  * @param hHFA 			HFAHandle 	HFA File Handle
+ * @param index 		HFAEntryIndex& 	Entry index of hHFA
  * @returns Eprj_MapInfo
  */
-const Eprj_MapInfo *getMapInfo(HFAHandle hHFA) {
+const Eprj_MapInfo *getMapInfo(HFAHandle hHFA, const HFAEntryIndex &index) {
     HFAEntry *mapInfoEntry;
     Eprj_MapInfo *mapInfo;
 
-    mapInfoEntry = find(hHFA->poRoot, "Map_Info");
+    mapInfoEntry = index.find("Map_Info");
     if (mapInfoEntry == NULL) {
         Log(WARN) << "No MapInfo found";
         return NULL;
@@ -55,13 +56,15 @@ const Eprj_MapInfo *getMapInfo(HFAHandle hHFA) {
  * Adapted from HFAGetProParameters (see getMapInfo docstring for more details)
  *
  * @param hHFA 				HFAHandle 	HFA File Handle
+ * @param index 			HFAEntryIndex& 	Entry index of hHFA
  * @returns Eprj_ProParameters
  */
-const Eprj_ProParameters *getProjectionParams(HFAHandle hHFA) {
+const Eprj_ProParameters *getProjectionParams(HFAHandle hHFA,
+                                              const HFAEntryIndex &index) {
     HFAEntry *projEntry;
     Eprj_ProParameters *projection;
 
-    projEntry = find(hHFA->poRoot, "Projection");
+    projEntry = index.find("Projection");
     if (projEntry == NULL) {
         Log(WARN) << "No Projection found";
         return NULL;
@@ -69,27 +72,46 @@ const Eprj_ProParameters *getProjectionParams(HFAHandle hHFA) {
 
     projection = (Eprj_ProParameters *)CPLCalloc(sizeof(Eprj_ProParameters), 1);
 
-    projection->proType = (Eprj_ProType)projEntry->GetIntField("proType");
-    projection->proNumber = projEntry->GetIntField("proNumber");
-    projection->proExeName = CPLStrdup(projEntry->GetStringField("proExeName"));
-    projection->proName = CPLStrdup(projEntry->GetStringField("proName"));
-    projection->proZone = projEntry->GetIntField("proZone");
+    // field paths are compiled once up front, reads then go through them
+    HFAFieldPath *proType = projEntry->GetFieldPath("proType");
+    HFAFieldPath *proNumber = projEntry->GetFieldPath("proNumber");
+    HFAFieldPath *proExeName = projEntry->GetFieldPath("proExeName");
+    HFAFieldPath *proName = projEntry->GetFieldPath("proName");
+    HFAFieldPath *proZone = projEntry->GetFieldPath("proZone");
 
+    HFAFieldPath *proParams[15];
     for (int i = 0; i < 15; i++) {
         char szFieldName[30];
 
         sprintf(szFieldName, "proParams[%d]", i);
-        projection->proParams[i] = projEntry->GetDoubleField(szFieldName);
+        proParams[i] = projEntry->GetFieldPath(szFieldName);
     }
 
+    projection->proType = (Eprj_ProType)projEntry->GetIntField(proType);
+    projection->proNumber = projEntry->GetIntField(proNumber);
+    projection->proExeName = CPLStrdup(projEntry->GetStringField(proExeName));
+    projection->proName = CPLStrdup(projEntry->GetStringField(proName));
+    projection->proZone = projEntry->GetIntField(proZone);
+
+    for (int i = 0; i < 15; i++) {
+        projection->proParams[i] = projEntry->GetDoubleField(proParams[i]);
+    }
+
+    HFAFieldPath *sphereName =
+        projEntry->GetFieldPath("proSpheroid.sphereName");
+    HFAFieldPath *sphereA = projEntry->GetFieldPath("proSpheroid.a");
+    HFAFieldPath *sphereB = projEntry->GetFieldPath("proSpheroid.b");
+    HFAFieldPath *sphereESquared =
+        projEntry->GetFieldPath("proSpheroid.eSquared");
+    HFAFieldPath *sphereRadius = projEntry->GetFieldPath("proSpheroid.radius");
+
     projection->proSpheroid.sphereName =
-        CPLStrdup(projEntry->GetStringField("proSpheroid.sphereName"));
-    projection->proSpheroid.a = projEntry->GetDoubleField("proSpheroid.a");
-    projection->proSpheroid.b = projEntry->GetDoubleField("proSpheroid.b");
+        CPLStrdup(projEntry->GetStringField(sphereName));
+    projection->proSpheroid.a = projEntry->GetDoubleField(sphereA);
+    projection->proSpheroid.b = projEntry->GetDoubleField(sphereB);
     projection->proSpheroid.eSquared =
-        projEntry->GetDoubleField("proSpheroid.eSquared");
-    projection->proSpheroid.radius =
-        projEntry->GetDoubleField("proSpheroid.radius");
+        projEntry->GetDoubleField(sphereESquared);
+    projection->proSpheroid.radius = projEntry->GetDoubleField(sphereRadius);
 
     hHFA->pProParameters = (void *)projection;
 
@@ -102,13 +124,14 @@ const Eprj_ProParameters *getProjectionParams(HFAHandle hHFA) {
  * Adapted from HFAGetDatum (see getMapInfo docstring for more details)
  *
  * @param hHFA 			HFAHandle 	HFA File Handle
+ * @param index 		HFAEntryIndex& 	Entry index of hHFA
  * @returns Eprj_Datum
  */
-const Eprj_Datum *getDatum(HFAHandle hHFA) {
+const Eprj_Datum *getDatum(HFAHandle hHFA, const HFAEntryIndex &index) {
     HFAEntry *datumEntry;
     Eprj_Datum *datum;
 
-    datumEntry = find(hHFA->poRoot, "Datum");
+    datumEntry = index.find("Datum");
     if (datumEntry == NULL) {
         Log(WARN) << "No Datum found";
         return NULL;
@@ -149,17 +172,19 @@ const Eprj_Datum *getDatum(HFAHandle hHFA) {
  * could treat it as a well known datum
  * - Supported Projections: UTM
  *
- * @param root 	HFAEntry* 			Root node
+ * @param hHFA 	HFAHandle 			HFA File Handle
+ * @param index 	HFAEntryIndex& 			Entry index of hHFA
  * @param srs 	OGRSpatialReference& 		OGR spatial reference object
  */
-bool extract_proj(HFAHandle hHFA, OGRSpatialReference &srs) {
+bool extract_proj(HFAHandle hHFA, const HFAEntryIndex &index,
+                  OGRSpatialReference &srs) {
     const Eprj_MapInfo *mapInfo;
     const Eprj_ProParameters *projectionParams;
     const Eprj_Datum *datum;
 
-    mapInfo = getMapInfo(hHFA);
-    projectionParams = getProjectionParams(hHFA);
-    datum = getDatum(hHFA);
+    mapInfo = getMapInfo(hHFA, index);
+    projectionParams = getProjectionParams(hHFA, index);
+    datum = getDatum(hHFA, index);
 
     if (mapInfo == NULL || projectionParams == NULL) {
         // no map information present
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <mutex>
 #include <sstream>
 
 
@@ -6,7 +7,8 @@ using namespace std;
 
 enum logtype { INFO, WARN, ERROR };
 
-extern string CURRSRC;
+// source file being processed by the calling thread
+extern thread_local string CURRSRC;
 
 inline const char *logtypetoStr(logtype lt) {
     switch (lt) {
@@ -23,6 +25,12 @@ inline const char *logtypetoStr(logtype lt) {
     return "";
 }
 
+// serializes whole log lines written from different threads
+inline mutex &logMutex() {
+    static mutex m;
+    return m;
+}
+
 class Log {
     ostringstream os;
 
@@ -37,7 +45,10 @@ class Log {
         }
     }
 
-    ~Log() { cout << os.str().c_str() << endl; };
+    ~Log() {
+        lock_guard<mutex> lock(logMutex());
+        cout << os.str().c_str() << endl;
+    };
 
     template <typename T> Log &operator<<(T msg) {
         os << msg;
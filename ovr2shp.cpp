@@ -6,7 +6,49 @@
 
 using namespace std;
 
-string CURRSRC = "";
+thread_local string CURRSRC = "";
+
+// bump when a change alters the output for unchanged inputs
+const string OVR2SHP_VERSION = "0.1.1";
+
+const string MANIFEST_FILENAME = ".ovr2shp-manifest";
+const string MANIFEST_HEADER = "ovr2shp-manifest 1";
+
+// file name stem of the -merge output, e.g. mergedTEXT.shp or merged.gpkg
+const string MERGE_STEM = "merged";
+
+// values of -f
+const set<string> OUTPUT_FORMATS = {"SHP", "GeoJSON", "GeoJSONSeq",
+                                    "FlatGeobuf", "Parquet", "GPKG"};
+
+// values of -parquet-compression
+const set<string> PARQUET_COMPRESSIONS = {"NONE",   "SNAPPY", "GZIP",
+                                          "BROTLI", "ZSTD",   "LZ4_RAW"};
+
+/*
+ * ConvertOptions
+ *
+ * settings of a conversion run, shared read-only by all workers
+ *
+ */
+struct ConvertOptions {
+    char *user_srs = NULL; // proj4
+    string format = "SHP"; // one of OUTPUT_FORMATS
+
+    // GeoJSON digits after the decimal point, < 0 for shortest round-trip
+    int precision = -1;
+
+    // GeoJSON in the source SRS with a legacy crs member, instead of WGS84
+    bool sourceCRS = false;
+
+    // -spatial-index, -batch-size and the Parquet flags
+    HFAOGROptions ogr;
+
+    // -merge: every source is appended here, its source field is the path
+    // relative to merge_root
+    HFAMergeWriter *merge = NULL;
+    fs::path merge_root;
+};
 
 #ifdef GPLOT
 /*
@@ -35,7 +77,11 @@ void plot(vector<HFAAnnotation *> annotations, int buffer = 1) {
     vector<pair<double, double>> combined;
     vector<HFAAnnotation *>::iterator it;
     for (it = annotations.begin(); it != annotations.end(); ++it) {
-        vector<pair<double, double>> pts = (*it)->get_geom()->get_pts();
+        HFACoordView view = (*it)->get_geom()->get_pts();
+        vector<pair<double, double>> pts;
+        for (size_t i = 0; i < view.size(); i++) {
+            pts.push_back(make_pair(view.x(i), view.y(i)));
+        }
         combined.insert(combined.end(), pts.begin(), pts.end());
         if (pts.size() == 1) {
             cmd += g.file1d(pts) + "title '" + (*it)->get_name() + "', \\\n";
@@ -117,27 +163,44 @@ void display(HFAHandle hHFA, HFAAnnotationLayer *hfaal, bool displayAnno,
     }
 }
 
-bool ovr2shp(fs::path file_path, fs::path output_dir, char *user_srs) {
-    HFAHandle hHFA = HFAOpen(file_path.string().c_str(), "r");
+bool ovr2shp(fs::path file_path, fs::path output_dir,
+             const ConvertOptions &opts) {
+    // everything allocated for the file is released on return, the layer
+    // before the handle whose tree it points into
+    HFAHandlePtr hHFA(HFAOpen(file_path.string().c_str(), "rm"));
     if (hHFA == NULL) {
         Log(ERROR) << "HFA driver failed to open " << file_path;
-    }
-
-    HFAAnnotationLayer *hfaal = new HFAAnnotationLayer(hHFA);
-    if (hfaal->is_empty()) {
         return false;
     }
 
-    if (user_srs != NULL) {
-        hfaal->set_srs(user_srs);
-        Log(INFO) << "user defined srs: " << user_srs;
-    }
-
-    fs::path shp_path = output_dir / file_path.stem() / file_path.stem();
+    // annotations are streamed straight to the output
+    unique_ptr<HFAAnnotationLayer> hfaal(
+        new HFAAnnotationLayer(hHFA.get(), false));
 
-    fs::create_directories(shp_path.parent_path());
+    if (opts.user_srs != NULL) {
+        hfaal->set_srs(opts.user_srs);
+        Log(INFO) << "user defined srs: " << opts.user_srs;
+    }
 
-    bool converted = hfaal->to_shp(shp_path);
+    // outputs of a source share a directory and a file name stem
+    fs::path dst = output_dir / file_path.stem() / file_path.stem();
+
+    bool converted;
+    if (opts.merge != NULL) {
+        converted = opts.merge->add(
+            *hfaal, file_path.lexically_relative(opts.merge_root).string());
+    } else if (opts.format == "GeoJSON" || opts.format == "GeoJSONSeq") {
+        converted = hfaal->to_gjson(dst, opts.format == "GeoJSONSeq",
+                                    opts.precision, opts.sourceCRS);
+    } else if (opts.format == "FlatGeobuf") {
+        converted = hfaal->to_fgb(dst);
+    } else if (opts.format == "Parquet") {
+        converted = hfaal->to_parquet(dst, opts.ogr);
+    } else if (opts.format == "GPKG") {
+        converted = hfaal->to_gpkg(dst, opts.ogr);
+    } else {
+        converted = hfaal->to_shp(dst, opts.ogr);
+    }
     if (converted) {
         Log(INFO) << "Successfully converted ✓"
                   << "\n";
@@ -149,16 +212,279 @@ bool ovr2shp(fs::path file_path, fs::path output_dir, char *user_srs) {
     return converted;
 }
 
+/************************************************************************/
+/*                                                                      */
+/*                           Output Manifest                            */
+/*                                                                      */
+/*      Records what each source looked like when it was last           */
+/*      converted, so unchanged sources can be skipped on re-runs.      */
+/*                                                                      */
+/************************************************************************/
+
+struct ManifestEntry {
+    uintmax_t size = 0;
+    long long mtime = 0;
+    string hash;
+};
+
+/*
+ * stat_source [utility]
+ *
+ * @param src	 fs::path
+ * @param entry  ManifestEntry&	size and mtime of src (hash is left as is)
+ *
+ * @return bool false if src cannot be stat'ed
+ */
+bool stat_source(const fs::path &src, ManifestEntry &entry) {
+    error_code ec;
+    uintmax_t size = fs::file_size(src, ec);
+    if (ec) {
+        return false;
+    }
+
+    fs::file_time_type mtime = fs::last_write_time(src, ec);
+    if (ec) {
+        return false;
+    }
+
+    entry.size = size;
+    entry.mtime = (long long)mtime.time_since_epoch().count();
+    return true;
+}
+
+/*
+ * hash_source [utility]
+ *
+ * 64-bit FNV-1a hash of the file content
+ *
+ * @param src	fs::path
+ *
+ * @return string hex digest, empty if src cannot be read
+ */
+string hash_source(const fs::path &src) {
+    ifstream in(src, ios::binary);
+    if (!in) {
+        return "";
+    }
+
+    uint64_t hash = 14695981039346656037ULL;
+    vector<char> buf(1 << 16);
+    while (in) {
+        in.read(buf.data(), buf.size());
+        streamsize n = in.gcount();
+        for (streamsize i = 0; i < n; i++) {
+            hash ^= (unsigned char)buf[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    ostringstream ss;
+    ss << hex << setw(16) << setfill('0') << hash;
+    return ss.str();
+}
+
+/*
+ * read_manifest [utility]
+ *
+ * Manifest layout (tab separated, source path last):
+ *   ovr2shp-manifest 1
+ *   <tool version and options>
+ *   <size>	<mtime>	<hash>	<source path>
+ *   ...
+ *
+ * @param file		fs::path
+ * @param signature	const string&	tool version and options of this run
+ * @param entries	map<string, ManifestEntry>& entries by source path
+ *
+ * @return bool true if the manifest was written with the same signature,
+ * entries are read either way so deleted sources can still be pruned
+ */
+bool read_manifest(const fs::path &file, const string &signature,
+                   map<string, ManifestEntry> &entries) {
+    ifstream in(file);
+    string line;
+    if (!getline(in, line) || line != MANIFEST_HEADER) {
+        return false;
+    }
+
+    string fileSignature;
+    getline(in, fileSignature);
+
+    while (getline(in, line)) {
+        istringstream ls(line);
+        ManifestEntry entry;
+        string src;
+        if (ls >> entry.size >> entry.mtime >> entry.hash &&
+            ls.get() == '\t' && getline(ls, src) && !src.empty()) {
+            entries[src] = entry;
+        }
+    }
+
+    return fileSignature == signature;
+}
+
+/*
+ * write_manifest [utility]
+ *
+ * write to a temporary file first so an interrupted run never leaves a
+ * truncated manifest behind
+ *
+ * @return bool
+ */
+bool write_manifest(const fs::path &file, const string &signature,
+                    const map<string, ManifestEntry> &entries) {
+    fs::path tmp = file;
+    tmp += ".tmp";
+
+    {
+        error_code ec;
+        fs::create_directories(file.parent_path(), ec);
+
+        ofstream out(tmp);
+        out << MANIFEST_HEADER << "\n" << signature << "\n";
+
+        map<string, ManifestEntry>::const_iterator it;
+        for (it = entries.begin(); it != entries.end(); ++it) {
+            out << it->second.size << "\t" << it->second.mtime << "\t"
+                << it->second.hash << "\t" << it->first << "\n";
+        }
+
+        if (!out) {
+            Log(ERROR) << "Unable to write manifest " << tmp;
+            return false;
+        }
+    }
+
+    error_code ec;
+    fs::rename(tmp, file, ec);
+    if (ec) {
+        Log(ERROR) << "Unable to write manifest " << file << ": "
+                   << ec.message();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * manifest_key [utility]
+ *
+ * @return string absolute, normalized source path
+ */
+string manifest_key(const fs::path &src) {
+    return fs::absolute(src).lexically_normal().string();
+}
+
+/*
+ * convert_parallel
+ *
+ * convert .ovr files with a pool of worker threads
+ *
+ * - files are sorted largest first (by file_size) and dealt round-robin into
+ * one deque per worker, so every worker starts on the big files and the run
+ * does not end on a single large straggler
+ * - a worker takes files from the front of its own deque and, once that is
+ * empty, steals from the back of the other workers' deques
+ *
+ * @param files		vector<fs::path>	.ovr files to convert
+ * @param output_dir	fs::path
+ * @param opts		const ConvertOptions&
+ * @param nJobs		int			number of worker threads
+ *
+ * @return vector<fs::path> files that failed to convert
+ */
+vector<fs::path> convert_parallel(vector<fs::path> files, fs::path output_dir,
+                                  const ConvertOptions &opts, int nJobs) {
+    vector<pair<uintmax_t, fs::path>> jobs;
+    for (size_t i = 0; i < files.size(); i++) {
+        error_code ec;
+        uintmax_t size = fs::file_size(files[i], ec);
+        jobs.push_back(make_pair(ec ? 0 : size, files[i]));
+    }
+
+    sort(jobs.begin(), jobs.end(),
+         [](const pair<uintmax_t, fs::path> &a,
+            const pair<uintmax_t, fs::path> &b) {
+             return (a.first != b.first) ? a.first > b.first
+                                         : a.second < b.second;
+         });
+
+    vector<deque<size_t>> queues(nJobs);
+    vector<mutex> queueLocks(nJobs);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i % nJobs].push_back(i);
+    }
+
+    // no files are queued once workers start, so empty deques mean done
+    auto next_job = [&](int worker, size_t &job) {
+        for (int k = 0; k < nJobs; k++) {
+            int victim = (worker + k) % nJobs;
+            lock_guard<mutex> lock(queueLocks[victim]);
+            if (queues[victim].empty()) {
+                continue;
+            }
+
+            if (victim == worker) {
+                job = queues[victim].front();
+                queues[victim].pop_front();
+            } else {
+                job = queues[victim].back();
+                queues[victim].pop_back();
+            }
+            return true;
+        }
+
+        return false;
+    };
+
+    vector<char> converted(jobs.size(), 0);
+    vector<thread> workers;
+    for (int w = 0; w < nJobs; w++) {
+        workers.push_back(thread([&, w]() {
+            size_t job;
+            while (next_job(w, job)) {
+                CURRSRC = jobs[job].second.string();
+                converted[job] = ovr2shp(jobs[job].second, output_dir, opts);
+            }
+        }));
+    }
+
+    for (size_t w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+
+    vector<fs::path> failed;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (!converted[i]) {
+            failed.push_back(jobs[i].second);
+        }
+    }
+
+    return failed;
+}
+
 int main(int argc, char *argv[]) {
     bool displayAnno = false, displayTree = false, displayDict = false,
-         plotAnno = false, userDefinedSRS = false, convertSrc = false;
+         plotAnno = false, userDefinedSRS = false, convertSrc = false,
+         merge = false;
 
     const string displayAnnoFlag = "-d", displayTreeFlag = "-dt",
                  displayDictFlag = "-dd", plotFlag = "-p", srsFlag = "-srs",
-                 outputDirFlag = "-o";
+                 outputDirFlag = "-o", arcToleranceFlag = "-arc-tolerance",
+                 jobsFlag = "-j", formatFlag = "-f",
+                 precisionFlag = "-precision", batchSizeFlag = "-batch-size",
+                 spatialIndexFlag = "-spatial-index", mergeFlag = "-merge",
+                 sourceCRSFlag = "-source-crs",
+                 rowGroupSizeFlag = "-parquet-row-group-size",
+                 compressionFlag = "-parquet-compression";
 
-    char *user_srs = NULL; // proj4
+    int nJobs = 1;
+
+    ConvertOptions opts;
     fs::path output_dir;
+
+    // options that change the output, recorded in the manifest
+    string signature = "ovr2shp " + OVR2SHP_VERSION;
     fs::path src_path;
 
     for (int i = 1; i < argc; i++) {
@@ -173,11 +499,83 @@ int main(int argc, char *argv[]) {
         } else if (argv[i] == srsFlag) {
             userDefinedSRS = true;
             i++;
-            user_srs = argv[i];
+            opts.user_srs = argv[i];
+            signature +=
+                string(" srs=") + (opts.user_srs ? opts.user_srs : "");
         } else if (argv[i] == outputDirFlag) {
             i++;
             output_dir = argv[i];
             convertSrc = true;
+        } else if (argv[i] == arcToleranceFlag) {
+            i++;
+            double arcTolerance = (i < argc) ? atof(argv[i]) : 0.0;
+            if (arcTolerance <= 0) {
+                Log(ERROR) << "-arc-tolerance expects a positive distance in "
+                              "map units";
+                exit(100);
+            }
+            HFAEllipse::set_arc_tolerance(arcTolerance);
+            signature += string(" arc-tolerance=") + argv[i];
+        } else if (argv[i] == jobsFlag) {
+            i++;
+            nJobs = (i < argc) ? atoi(argv[i]) : 0;
+            if (nJobs < 1) {
+                Log(ERROR) << "-j expects a positive number of jobs";
+                exit(100);
+            }
+        } else if (argv[i] == formatFlag) {
+            i++;
+            opts.format = (i < argc) ? argv[i] : "";
+            if (OUTPUT_FORMATS.count(opts.format) == 0) {
+                Log(ERROR) << "-f expects one of SHP, GeoJSON, GeoJSONSeq, "
+                              "FlatGeobuf, Parquet, GPKG";
+                exit(100);
+            }
+            signature += " format=" + opts.format;
+        } else if (argv[i] == precisionFlag) {
+            i++;
+            opts.precision = (i < argc) ? atoi(argv[i]) : -1;
+            if (opts.precision < 0 || opts.precision > 17) {
+                Log(ERROR) << "-precision expects 0 to 17 decimal places";
+                exit(100);
+            }
+            signature += " precision=" + to_string(opts.precision);
+        } else if (argv[i] == sourceCRSFlag) {
+            opts.sourceCRS = true;
+            signature += " source-crs";
+        } else if (argv[i] == mergeFlag) {
+            merge = true;
+            signature += " merge";
+        } else if (argv[i] == spatialIndexFlag) {
+            opts.ogr.spatialIndex = true;
+            signature += " spatial-index";
+        } else if (argv[i] == batchSizeFlag) {
+            i++;
+            opts.ogr.batchSize = (i < argc) ? atoi(argv[i]) : 0;
+            if (opts.ogr.batchSize < 1) {
+                Log(ERROR) << "-batch-size expects a positive number of "
+                              "features";
+                exit(100);
+            }
+        } else if (argv[i] == rowGroupSizeFlag) {
+            i++;
+            opts.ogr.rowGroupSize = (i < argc) ? atoi(argv[i]) : 0;
+            if (opts.ogr.rowGroupSize < 1) {
+                Log(ERROR) << "-parquet-row-group-size expects a positive "
+                              "number of rows";
+                exit(100);
+            }
+            signature += " parquet-row-group-size=" +
+                         to_string(opts.ogr.rowGroupSize);
+        } else if (argv[i] == compressionFlag) {
+            i++;
+            opts.ogr.compression = (i < argc) ? argv[i] : "";
+            if (PARQUET_COMPRESSIONS.count(opts.ogr.compression) == 0) {
+                Log(ERROR) << "-parquet-compression expects one of NONE, "
+                              "SNAPPY, GZIP, BROTLI, ZSTD, LZ4_RAW";
+                exit(100);
+            }
+            signature += " parquet-compression=" + opts.ogr.compression;
         } else if (src_path.empty()) {
             src_path = argv[i];
         }
@@ -190,6 +588,12 @@ int main(int argc, char *argv[]) {
         exit(100);
     }
 
+    if (merge &&
+        (opts.format == "GeoJSON" || opts.format == "GeoJSONSeq")) {
+        Log(ERROR) << "-merge expects -f SHP, FlatGeobuf, Parquet or GPKG";
+        exit(100);
+    }
+
     if (convertSrc) {
         Log(INFO) << "mode: CONVERT";
         Log(WARN) << "display flags are ignored";
@@ -198,16 +602,123 @@ int main(int argc, char *argv[]) {
             Log(INFO) << "src: " << src_path << " "
                       << "out: " << output_dir;
 
-            vector<fs::path> failed;
+            vector<fs::path> files;
             fs::recursive_directory_iterator rDirIt(src_path);
             for (auto &p : rDirIt) {
                 if (p.path().extension() == ".ovr") {
-                    CURRSRC = p.path().string();
-                    if (!ovr2shp(p.path(), output_dir, user_srs)) {
-                        failed.push_back(p.path());
+                    files.push_back(p.path());
+                }
+            }
+
+            // skip sources that are unchanged since the last run with the
+            // same tool version and options
+            fs::path manifestPath = output_dir / MANIFEST_FILENAME;
+            map<string, ManifestEntry> prevManifest, manifest;
+            bool reuse = read_manifest(manifestPath, signature, prevManifest);
+
+            // the merged output is rewritten from every source on each run,
+            // it is closed once the workers are done, so its indexes can be
+            // built with the whole -j budget
+            unique_ptr<HFAMergeWriter> mergeWriter;
+            if (merge) {
+                HFAOGROptions mergeOpts = opts.ogr;
+                mergeOpts.indexJobs = nJobs;
+                mergeWriter.reset(new HFAMergeWriter(
+                    opts.format, output_dir / MERGE_STEM, mergeOpts));
+                opts.merge = mergeWriter.get();
+                opts.merge_root = src_path;
+                reuse = false;
+            }
+
+            vector<fs::path> pending;
+            map<string, ManifestEntry> pendingStats;
+            set<string> liveKeys, liveStems;
+            for (size_t i = 0; i < files.size(); i++) {
+                string key = manifest_key(files[i]);
+                liveKeys.insert(key);
+                liveStems.insert(files[i].stem().string());
+
+                ManifestEntry entry;
+                if (!stat_source(files[i], entry)) {
+                    pending.push_back(files[i]);
+                    continue;
+                }
+
+                map<string, ManifestEntry>::const_iterator prev =
+                    prevManifest.find(key);
+                if (reuse && prev != prevManifest.end() &&
+                    prev->second.size == entry.size) {
+                    // stat only when nothing changed, hash when only the
+                    // mtime moved
+                    if (prev->second.mtime == entry.mtime ||
+                        prev->second.hash == hash_source(files[i])) {
+                        entry.hash = prev->second.hash;
+                        manifest[key] = entry;
+                        continue;
+                    }
+                }
+
+                pendingStats[key] = entry;
+                pending.push_back(files[i]);
+            }
+
+            Log(INFO) << "unchanged: " << (files.size() - pending.size())
+                      << " to convert: " << pending.size();
+
+            vector<fs::path> failed;
+            if (nJobs > 1) {
+                Log(INFO) << "jobs: " << nJobs;
+                failed = convert_parallel(pending, output_dir, opts, nJobs);
+            } else {
+                for (size_t i = 0; i < pending.size(); i++) {
+                    CURRSRC = pending[i].string();
+                    if (!ovr2shp(pending[i], output_dir, opts)) {
+                        failed.push_back(pending[i]);
                     }
                 }
             }
+            CURRSRC.clear();
+
+            if (mergeWriter != NULL && !mergeWriter->close()) {
+                Log(ERROR) << "Failed to write merged output "
+                           << (output_dir / MERGE_STEM);
+                failed = pending;
+            }
+
+            // report in path order, whatever order the files finished in
+            sort(failed.begin(), failed.end());
+
+            // failed sources are left out so that they are retried
+            for (size_t i = 0; i < pending.size(); i++) {
+                string key = manifest_key(pending[i]);
+                map<string, ManifestEntry>::iterator stat =
+                    pendingStats.find(key);
+                if (stat == pendingStats.end() ||
+                    binary_search(failed.begin(), failed.end(), pending[i])) {
+                    continue;
+                }
+
+                stat->second.hash = hash_source(pending[i]);
+                manifest[key] = stat->second;
+            }
+
+            // prune outputs of sources that no longer exist, unless a live
+            // source writes to the same output directory
+            map<string, ManifestEntry>::const_iterator prevIt;
+            for (prevIt = prevManifest.begin(); prevIt != prevManifest.end();
+                 ++prevIt) {
+                fs::path gone = prevIt->first;
+                if (liveKeys.count(prevIt->first) ||
+                    liveStems.count(gone.stem().string())) {
+                    continue;
+                }
+
+                error_code ec;
+                fs::remove_all(output_dir / gone.stem(), ec);
+                Log(INFO) << "pruned outputs of deleted source " << gone;
+            }
+
+            write_manifest(manifestPath, signature, manifest);
 
             if (!failed.empty()) {
                 cout << "Failed to convert: " << endl;
@@ -217,24 +728,31 @@ int main(int argc, char *argv[]) {
                 }
             }
         } else if (is_file_valid(src_path, validate_ovr)) {
+            if (merge) {
+                Log(WARN) << "-merge is ignored for a single source";
+            }
+
             Log(INFO) << "src: " << src_path << " "
                       << "out: " << output_dir;
             CURRSRC = src_path.string();
-            ovr2shp(src_path, output_dir, user_srs);
+            ovr2shp(src_path, output_dir, opts);
         }
     } else if (is_file_valid(src_path, validate_rMode)) {
         Log(INFO) << "mode: READ";
         Log(INFO) << "src: " << src_path;
 
         CURRSRC = src_path.string();
-        HFAHandle hHFA = HFAOpen(src_path.string().c_str(), "r");
+        HFAHandlePtr hHFA(HFAOpen(src_path.string().c_str(), "rm"));
         if (hHFA == NULL) {
             Log(ERROR) << "HFA driver failed to open " << src_path;
+            return 1;
         }
 
-        HFAAnnotationLayer *hfaal = new HFAAnnotationLayer(hHFA);
+        unique_ptr<HFAAnnotationLayer> hfaal(
+            new HFAAnnotationLayer(hHFA.get()));
 
-        display(hHFA, hfaal, displayAnno, displayTree, displayDict, plotAnno);
+        display(hHFA.get(), hfaal.get(), displayAnno, displayTree, displayDict,
+                plotAnno);
     }
 
     return 0;
@@ -1,9 +1,16 @@
+#include <algorithm>
 #include <cmath>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "hfa_p.h"
@@ -19,21 +26,279 @@ extern const string HFA_ANNOTATION_XFORM_ATTR_NAME;
 extern const string HFA_XFORM_COEF_ATTR_NAME;
 extern const string HFA_XFORM_VECT_ATTR_NAME;
 
+/*
+ * HFAHandlePtr
+ *
+ * owns an HFA handle, closing it (and freeing its entry tree) when it goes
+ * out of scope
+ *
+ */
+struct HFAHandleCloser {
+    void operator()(HFAHandle hHFA) const { HFAClose(hHFA); }
+};
+
+typedef unique_ptr<HFAInfo_t, HFAHandleCloser> HFAHandlePtr;
+
 /*
  * Prototypes
  *
  */
 
-HFAEntry *find(HFAEntry *node, string name);
+class HFAEntryIndex;
+class HFACoordView;
+
+void rotation_xform(const double *center, double orientation, double *m);
+
+void compose_xform(const double *outer, const double *inner, double *m);
+
+bool is_identity_xform(const double *m);
+
+void affine_transform(double *xs, double *ys, size_t n, const double *m);
+
+bool extract_proj(HFAHandle hHFA, const HFAEntryIndex &index,
+                  OGRSpatialReference &srs);
+
+string to_polyWKT(const HFACoordView &pts);
+
+string to_linestrWKT(const HFACoordView &pts);
+
+/************************************************************************/
+/*                                                                      */
+/*                            HFAEntryIndex                             */
+/*                                                                      */
+/*      Name/type -> entries lookup built in a single walk of the tree, */
+/*      or of the tree outside its element lists when sparse            */
+/*                                                                      */
+/************************************************************************/
+
+class HFAEntryIndex {
+    unordered_map<string, vector<HFAEntry *>> byName;
+    unordered_map<string, vector<HFAEntry *>> byType;
+
+    // entries not nested under another entry of the same name
+    unordered_map<string, vector<HFAEntry *>> outermostByName;
+
+    static const vector<HFAEntry *> &
+    lookup(const unordered_map<string, vector<HFAEntry *>> &idx,
+           const string &key);
+
+    void add_sparse(HFAEntry *root);
+
+  public:
+    HFAEntryIndex(HFAEntry *root, bool sparse = false);
+
+    HFAEntry *find(const string &name) const {
+        const vector<HFAEntry *> &entries = lookup(byName, name);
+        return entries.empty() ? NULL : entries.front();
+    }
+
+    const vector<HFAEntry *> &find_all(const string &name) const {
+        return lookup(byName, name);
+    }
+
+    const vector<HFAEntry *> &find_outermost(const string &name) const {
+        return lookup(outermostByName, name);
+    }
+
+    const vector<HFAEntry *> &find_type(const string &type) const {
+        return lookup(byType, type);
+    }
+};
+
+/************************************************************************/
+/*                                                                      */
+/*                            HFACoordStore                             */
+/*                                                                      */
+/*      Contiguous x[]/y[] coordinate arena owned by a layer. Shapes    */
+/*      keep (offset, length) spans into it and hand out non-owning     */
+/*      views. Views are invalidated by further appends.                */
+/*                                                                      */
+/************************************************************************/
+
+struct HFACoordSpan {
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+class HFACoordView {
+    const double *xs = NULL;
+    const double *ys = NULL;
+    size_t n = 0;
+
+  public:
+    HFACoordView() {}
+
+    HFACoordView(const double *xs, const double *ys, size_t n)
+        : xs(xs), ys(ys), n(n) {}
+
+    size_t size() const { return n; }
+
+    bool empty() const { return n == 0; }
+
+    double x(size_t i) const { return xs[i]; }
+
+    double y(size_t i) const { return ys[i]; }
+
+    const double *x_data() const { return xs; }
+
+    const double *y_data() const { return ys; }
+};
+
+class HFACoordStore {
+    vector<double> xs;
+    vector<double> ys;
+
+    // reusable staging buffer for decoding interleaved coordinates
+    vector<double> scratch;
+
+  public:
+    size_t size() const { return xs.size(); }
+
+    // drop all coordinates, keeping the allocated capacity
+    void clear() {
+        xs.clear();
+        ys.clear();
+    }
+
+    void push(double x, double y) {
+        xs.push_back(x);
+        ys.push_back(y);
+    }
+
+    // span of everything appended since offset
+    HFACoordSpan span_from(size_t offset) const {
+        HFACoordSpan span;
+        span.offset = offset;
+        span.length = xs.size() - offset;
+        return span;
+    }
+
+    double *x_data(const HFACoordSpan &span) {
+        return xs.data() + span.offset;
+    }
 
-vector<pair<double, double>> rotate(vector<pair<double, double>> pts,
-                                    double *center, double orientation);
+    double *y_data(const HFACoordSpan &span) {
+        return ys.data() + span.offset;
+    }
 
-bool extract_proj(HFAHandle hHFA, OGRSpatialReference &srs);
+    HFACoordView view(const HFACoordSpan &span) const {
+        return HFACoordView(xs.data() + span.offset, ys.data() + span.offset,
+                            span.length);
+    }
+
+    double *get_scratch(size_t n) {
+        if (scratch.size() < n) {
+            scratch.resize(n);
+        }
+        return scratch.data();
+    }
+};
+
+/************************************************************************/
+/*                                                                      */
+/*                            HFAEantFields                             */
+/*                                                                      */
+/*      Compiled field paths of the Eant_* types the converter reads,   */
+/*      resolved once per HFAType and reused for every element          */
+/*                                                                      */
+/************************************************************************/
+
+// Eant_Element
+struct HFAElementFields {
+    HFAFieldPath *id = NULL, *name = NULL, *description = NULL,
+                 *elmType = NULL;
+
+    HFAElementFields() {}
+
+    explicit HFAElementFields(HFAEntry *node)
+        : id(node->GetFieldPath("id")), name(node->GetFieldPath("name")),
+          description(node->GetFieldPath("description")),
+          elmType(node->GetFieldPath("elmType")) {}
+};
 
-string to_polyWKT(vector<pair<double, double>> pts);
+// Eant_Ellipse
+struct HFAEllipseFields {
+    HFAFieldPath *centerX = NULL, *centerY = NULL, *orientation = NULL,
+                 *semiMajorAxis = NULL, *semiMinorAxis = NULL;
 
-string to_linestrWKT(vector<pair<double, double>> pts);
+    HFAEllipseFields() {}
+
+    explicit HFAEllipseFields(HFAEntry *node)
+        : centerX(node->GetFieldPath("center.x")),
+          centerY(node->GetFieldPath("center.y")),
+          orientation(node->GetFieldPath("orientation")),
+          semiMajorAxis(node->GetFieldPath("semiMajorAxis")),
+          semiMinorAxis(node->GetFieldPath("semiMinorAxis")) {}
+};
+
+// Eant_Rectangle
+struct HFARectangleFields {
+    HFAFieldPath *centerX = NULL, *centerY = NULL, *orientation = NULL,
+                 *width = NULL, *height = NULL;
+
+    HFARectangleFields() {}
+
+    explicit HFARectangleFields(HFAEntry *node)
+        : centerX(node->GetFieldPath("center.x")),
+          centerY(node->GetFieldPath("center.y")),
+          orientation(node->GetFieldPath("orientation")),
+          width(node->GetFieldPath("width")),
+          height(node->GetFieldPath("height")) {}
+};
+
+// Eant_Text
+struct HFATextFields {
+    HFAFieldPath *originX = NULL, *originY = NULL, *text = NULL;
+
+    HFATextFields() {}
+
+    explicit HFATextFields(HFAEntry *node)
+        : originX(node->GetFieldPath("origin.x")),
+          originY(node->GetFieldPath("origin.y")),
+          text(node->GetFieldPath("text.string")) {}
+};
+
+/*
+ * HFATypeFields
+ *
+ * Fields compiled once for each HFAType they are asked for. Walks visit
+ * element and shape nodes of different types in turn, so every type seen
+ * keeps its own entry; the last one is checked first.
+ *
+ */
+template <typename Fields> class HFATypeFields {
+    // map nodes do not move, so last stays valid as types are added
+    unordered_map<HFAType *, Fields> byType;
+    HFAType *lastType = NULL;
+    const Fields *last = NULL;
+
+  public:
+    // node's data must be loaded
+    const Fields &of(HFAEntry *node) {
+        HFAType *type = node->GetPoType();
+        if (last != NULL && type == lastType) {
+            return *last;
+        }
+
+        typename unordered_map<HFAType *, Fields>::iterator it =
+            byType.find(type);
+        if (it == byType.end()) {
+            it = byType.insert(make_pair(type, Fields(node))).first;
+        }
+
+        lastType = type;
+        last = &it->second;
+        return *last;
+    }
+};
+
+// per layer, a layer is decoded by one thread
+struct HFAEantFields {
+    HFATypeFields<HFAElementFields> element;
+    HFATypeFields<HFAEllipseFields> ellipse;
+    HFATypeFields<HFARectangleFields> rectangle;
+    HFATypeFields<HFATextFields> text;
+};
 
 /************************************************************************/
 /*                                                                      */
@@ -44,10 +309,26 @@ string to_linestrWKT(vector<pair<double, double>> pts);
 /************************************************************************/
 
 class HFAGeom {
+  protected:
+    HFACoordStore *store;
+    HFACoordSpan span;
+
+    // placement of the shape's points within the annotation (e.g. its
+    // rotation), same layout as HFAAnnotation xform
+    double local[6] = {1.0, 0.0, 0.0, 1.0, 0.0, 0.0};
+
+    HFAGeom(HFACoordStore &store) : store(&store) {}
+
   public:
     virtual ~HFAGeom(){}; // for dynamic_cast
 
-    virtual vector<pair<double, double>> get_pts() const = 0;
+    HFACoordView get_pts() const { return store->view(span); }
+
+    HFACoordSpan get_span() const { return span; }
+
+    HFACoordStore *get_store() const { return store; }
+
+    const double *get_local_xform() const { return local; }
 
     virtual void write(ostream &) const = 0;
 
@@ -67,16 +348,27 @@ class HFAGeom {
 /************************************************************************/
 
 class HFAEllipse : public HFAGeom {
-    double *center;
+    double center[2];
     double rotation;
 
     double semiMajorAxis;
     double semiMinorAxis;
 
-    vector<pair<double, double>> get_unorientated_pts() const;
+    // max chord error (map units) when discretizing, <= 0 for the default
+    static double arcTolerance;
+
+    int get_num_segments() const;
+
+    void add_unorientated_pts();
 
   public:
-    HFAEllipse(HFAEntry *);
+    HFAEllipse(HFAEntry *, HFACoordStore &, const HFAEllipseFields &);
+
+    static void set_arc_tolerance(double tolerance) {
+        arcTolerance = tolerance;
+    }
+
+    bool get_arc_pts(const double *m, double *xs, double *ys) const;
 
     double *get_center() { return center; };
 
@@ -86,10 +378,6 @@ class HFAEllipse : public HFAGeom {
 
     double get_minX() { return semiMinorAxis; };
 
-    vector<pair<double, double>> get_pts() const {
-        return rotate(get_unorientated_pts(), center, rotation);
-    }
-
     void write(ostream &os) const {
         os << "center: " << center[0] << ", " << center[1] << endl;
         os << "rotation: " << rotation << endl;
@@ -107,16 +395,16 @@ class HFAEllipse : public HFAGeom {
 /************************************************************************/
 
 class HFARectangle : public HFAGeom {
-    double *center;
+    double center[2];
     double rotation;
 
     double width;
     double height;
 
-    vector<pair<double, double>> get_unorientated_pts() const;
+    void add_unorientated_pts();
 
   public:
-    HFARectangle(HFAEntry *);
+    HFARectangle(HFAEntry *, HFACoordStore &, const HFARectangleFields &);
 
     double *get_center() { return center; };
 
@@ -126,10 +414,6 @@ class HFARectangle : public HFAGeom {
 
     double get_height() { return height; };
 
-    vector<pair<double, double>> get_pts() const {
-        return rotate(get_unorientated_pts(), center, rotation);
-    }
-
     void write(ostream &os) const {
         os << "center: " << center[0] << ", " << center[1] << endl;
         os << "rotation: " << rotation << endl;
@@ -147,15 +431,10 @@ class HFARectangle : public HFAGeom {
 /************************************************************************/
 
 class HFAPolyline : public HFAGeom {
-  protected:
-    vector<pair<double, double>> pts;
-
   public:
-    HFAPolyline(HFAEntry *node);
+    HFAPolyline(HFAEntry *node, HFACoordStore &store);
 
     void write(ostream &os) const { return; }
-
-    vector<pair<double, double>> get_pts() const { return pts; }
 };
 
 /************************************************************************/
@@ -168,9 +447,14 @@ class HFAPolyline : public HFAGeom {
 
 class HFAPolygon : public HFAPolyline {
   public:
-    HFAPolygon(HFAEntry *node) : HFAPolyline(node) {
-        // enclose line to turn it into a polygon
-        pts.push_back(pts[0]);
+    HFAPolygon(HFAEntry *node, HFACoordStore &store)
+        : HFAPolyline(node, store) {
+        // enclose line to turn it into a polygon, the line's points are the
+        // last ones appended so the ring stays contiguous
+        if (span.length > 0) {
+            store.push(store.x_data(span)[0], store.y_data(span)[0]);
+            span.length++;
+        }
     };
 };
 
@@ -183,29 +467,26 @@ class HFAPolygon : public HFAPolyline {
 /************************************************************************/
 
 class HFAText : public HFAGeom {
-    double *origin;
+    double origin[2];
     const char *text;
 
   public:
-    HFAText(HFAEntry *node) {
-        origin = new double[2];
-        origin[0] = node->GetDoubleField("origin.x");
-        origin[1] = node->GetDoubleField("origin.y");
+    HFAText(HFAEntry *node, HFACoordStore &store, const HFATextFields &f)
+        : HFAGeom(store) {
+        origin[0] = node->GetDoubleField(f.originX);
+        origin[1] = node->GetDoubleField(f.originY);
+
+        text = node->GetStringField(f.text);
 
-        text = node->GetStringField("text.string");
+        size_t offset = store.size();
+        store.push(origin[0], origin[1]);
+        span = store.span_from(offset);
     }
 
     double *get_origin() { return origin; };
 
     const char *get_text() { return text; };
 
-    vector<pair<double, double>> get_pts() const {
-        vector<pair<double, double>> pts;
-        pts.push_back(make_pair(origin[0], origin[1]));
-
-        return pts;
-    }
-
     void write(ostream &os) const {
         os << "origin: " << origin[0] << ", " << origin[1] << endl;
         os << "textval: " << text << endl;
@@ -228,7 +509,7 @@ class HFAAnnotation {
     const char *elmType;
     int elmTypeId;
 
-    HFAGeom *geom;
+    unique_ptr<HFAGeom> geom;
 
     /*
      * coord_vect (1x3)
@@ -243,7 +524,7 @@ class HFAAnnotation {
     double xform[6];
 
   public:
-    HFAAnnotation(HFAEntry *);
+    HFAAnnotation(HFAEntry *, const HFAElementFields &);
 
     int get_id() { return id; };
 
@@ -257,11 +538,14 @@ class HFAAnnotation {
 
     int get_typeId() { return elmTypeId; };
 
-    HFAGeom *get_geom() { return geom; };
+    HFAGeom *get_geom() { return geom.get(); };
+
+    // takes ownership of g
+    void set_geom(HFAGeom *g) { geom.reset(g); };
 
-    void set_geom(HFAGeom *g) { geom = g; };
+    HFACoordView get_pts() const { return geom->get_pts(); }
 
-    vector<pair<double, double>> get_pts() const;
+    OGRGeometry *to_ogr(bool curves = false) const;
 
     string get_wkt() const;
 
@@ -289,6 +573,216 @@ class HFAAnnotation {
     }
 };
 
+/************************************************************************/
+/*                                                                      */
+/*                          HFAAnnotationSink                           */
+/*                                                                      */
+/*            Receives annotations one at a time as they are            */
+/*            decoded, e.g. an output writer                            */
+/*                                                                      */
+/************************************************************************/
+
+class HFAAnnotationSink {
+  public:
+    virtual ~HFAAnnotationSink() {}
+
+    // the annotation (and the HFAEntry data its strings point into) is only
+    // valid for the duration of the call
+    virtual bool write(HFAAnnotation &anno) = 0;
+};
+
+/************************************************************************/
+/*                                                                      */
+/*                            HFAOGRWriter                              */
+/*                                                                      */
+/*            Writes annotations to OGR datasets through a GDAL         */
+/*            vector driver, datasets and layers are created when       */
+/*            the first annotation that needs them appears              */
+/*                                                                      */
+/************************************************************************/
+
+// how annotations are laid out in the output
+enum HFAOGRLayout {
+    HFA_DATASET_PER_TYPE, // <dst><TYPE><ext>, e.g. shapefiles
+    HFA_LAYER_PER_TYPE,   // <dst><ext> with a <TYPE> layer per geometry type
+    HFA_SINGLE_LAYER      // <dst><ext> with one layer of mixed geometry
+};
+
+// spatial indexes built once all features are written
+enum HFAOGRIndex {
+    HFA_INDEX_NONE,  // none, or whatever the driver builds on its own
+    HFA_INDEX_RTREE, // GeoPackage R-tree, via CreateSpatialIndex()
+    HFA_INDEX_QIX    // shapefile quadtree (.qix), via CREATE SPATIAL INDEX
+};
+
+// per format settings of HFAOGRWriter::create, set from the command line
+struct HFAOGROptions {
+    // SHP: .qix quadtree next to each shapefile
+    bool spatialIndex = false;
+
+    // GPKG: features per transaction, 0 to leave transactions to the driver
+    int batchSize = 10000;
+
+    // Parquet: rows per row group and compression codec
+    int rowGroupSize = 65536;
+    string compression = "SNAPPY";
+
+    // threads that build spatial indexes on close, 1 inside a -j worker
+    int indexJobs = 1;
+};
+
+class HFAOGRWriter : public HFAAnnotationSink {
+    GDALDriver *driver;
+    fs::path dst;
+    string ext;
+    HFAOGRLayout layout;
+    OGRSpatialReference *srs;
+
+    // layer creation options, NAME=VALUE
+    vector<string> layerOptions;
+
+    // whether the driver can store curve geometries
+    bool curves;
+
+    // features per transaction, 0 to leave transactions to the driver
+    int batchSize = 0;
+
+    // index built on close, by up to indexJobs threads, one per dataset
+    HFAOGRIndex index = HFA_INDEX_NONE;
+    int indexJobs = 1;
+
+    // add a source field, set to the value of source on every feature
+    bool sourceField = false;
+    string source;
+
+    bool failed = false;
+
+    // keyed by geometry type, or 0 for a dataset/layer shared by all types
+    map<int, GDALDataset *> datasets;
+    map<int, OGRLayer *> layers;
+
+    // features in the open transaction of a dataset
+    map<int, int> batched;
+
+    int dataset_key(int gTypeId) const {
+        return (layout == HFA_DATASET_PER_TYPE) ? gTypeId : 0;
+    }
+
+    int layer_key(int gTypeId) const {
+        return (layout == HFA_SINGLE_LAYER) ? 0 : gTypeId;
+    }
+
+    OGRLayer *get_layer(int gTypeId);
+
+    void begin_batch(int dsKey);
+
+    void end_batch(int dsKey);
+
+    void build_indexes();
+
+  public:
+    HFAOGRWriter(GDALDriver *driver, fs::path dst, const string &ext,
+                 HFAOGRLayout layout, OGRSpatialReference *srs,
+                 const vector<string> &layerOptions = vector<string>());
+
+    static HFAOGRWriter *create(const string &format, fs::path dst,
+                                OGRSpatialReference *srs,
+                                const HFAOGROptions &opts = HFAOGROptions());
+
+    ~HFAOGRWriter() { close(); }
+
+    void set_batch_size(int n) { batchSize = n; }
+
+    void set_index(HFAOGRIndex idx, int nJobs = 1) {
+        index = idx;
+        indexJobs = nJobs;
+    }
+
+    // before the first write
+    void set_source_field(bool add) { sourceField = add; }
+
+    void set_source(const string &src) { source = src; }
+
+    bool write(HFAAnnotation &anno);
+
+    bool close();
+};
+
+/************************************************************************/
+/*                                                                      */
+/*                          HFAGeoJSONWriter                            */
+/*                                                                      */
+/*            Writes annotations of every geometry type to one          */
+/*            GeoJSON FeatureCollection, or a GeoJSON text              */
+/*            sequence (RFC 8142), through a large output buffer        */
+/*                                                                      */
+/************************************************************************/
+
+class HFAGeoJSONWriter : public HFAAnnotationSink {
+    fs::path dst;
+    FILE *fp = NULL;
+
+    // one feature per record instead of a FeatureCollection
+    bool seq;
+
+    // digits after the decimal point, < 0 for shortest round-trip
+    int precision;
+
+    // source SRS -> WGS84 longitude/latitude, NULL when the source
+    // coordinates are kept
+    OGRCoordinateTransformation *ct = NULL;
+
+    // legacy crs member naming the kept source SRS, empty for none
+    string crsName;
+
+    // reprojected points of the current feature
+    vector<double> xs, ys;
+
+    vector<char> buf;
+    size_t used = 0;
+
+    int nFeatures = 0;
+    bool failed = false;
+
+    bool open();
+
+    bool flush();
+
+    char *reserve(size_t n);
+
+    void put(const char *s, size_t n);
+
+    void put(const char *s) { put(s, strlen(s)); }
+
+    void put_int(long long val);
+
+    void put_double(double val);
+
+    void put_string(const char *s);
+
+    void put_point(double x, double y);
+
+    void put_points(const HFACoordView &pts);
+
+    void put_crs();
+
+    HFACoordView project(const HFACoordView &pts);
+
+  public:
+    HFAGeoJSONWriter(fs::path dst, bool seq, int precision,
+                     OGRSpatialReference *srs, bool sourceCRS = false);
+
+    ~HFAGeoJSONWriter();
+
+    HFAGeoJSONWriter(const HFAGeoJSONWriter &) = delete;
+
+    HFAGeoJSONWriter &operator=(const HFAGeoJSONWriter &) = delete;
+
+    bool write(HFAAnnotation &anno);
+
+    bool close();
+};
+
 /************************************************************************/
 /*                                                                      */
 /*                       HFAAnnotationLayer                             */
@@ -302,23 +796,51 @@ class HFAAnnotationLayer {
     HFAHandle hHFA;
     HFAEntry *root;
 
+    // sparse when streaming, only the SRS entries and element lists
+    HFAEntryIndex index;
+
     bool hasSRS = false;
     OGRSpatialReference srs;
     vector<HFAAnnotation *> annotations;
 
+    // coordinates of every annotation's shape, only the current one's when
+    // streaming
+    HFACoordStore coords;
+
+    // field paths of the element types, resolved on the first element
+    HFAEantFields eantFields;
+
+    // whether the annotations were decoded up front, otherwise they are
+    // streamed from the tree on export
+    bool loaded;
+
     GDALDataset *gdalDs;
 
     set<int> geomTypes;
 
     void display_HFATree(HFAEntry *node, int nIdent);
 
-    bool write_to_shp(const char *, fs::path);
+    void transform_coords();
+
+    bool write_to_ogr(const string &format, fs::path dst,
+                      const HFAOGROptions &opts = HFAOGROptions());
+
+    bool stream(HFAAnnotationSink &sink);
 
   public:
-    HFAAnnotationLayer(HFAHandle);
+    HFAAnnotationLayer(HFAHandle, bool load = true);
+
+    // annotations point into the tree, destroy the layer before closing hHFA
+    ~HFAAnnotationLayer();
+
+    HFAAnnotationLayer(const HFAAnnotationLayer &) = delete;
+
+    HFAAnnotationLayer &operator=(const HFAAnnotationLayer &) = delete;
 
     OGRSpatialReference get_srs() { return srs; };
 
+    bool has_srs() const { return hasSRS; }
+
     void set_srs(OGRSpatialReference new_srs) {
         hasSRS = true;
         srs = new_srs;
@@ -339,23 +861,80 @@ class HFAAnnotationLayer {
 
     void add_geomType(int nGeomType) { geomTypes.insert(nGeomType); }
 
-    bool to_shp(fs::path dst) {
-        const char *shpDriverName = "ESRI Shapefile";
-        return write_to_shp(shpDriverName, dst);
+    const HFAEntryIndex &get_index() const { return index; }
+
+    bool export_annos(HFAAnnotationSink &sink);
+
+    bool to_shp(fs::path dst, const HFAOGROptions &opts = HFAOGROptions()) {
+        return write_to_ogr("SHP", dst, opts);
     };
 
-    bool to_gjson(char *ofilename) {
-        // TODO  @NotImplemented
-        const char *gjsonDriverName = "GeoJSON";
-        cerr << "GeoJSON is not supported yet!" << endl;
-        return false;
+    bool to_fgb(fs::path dst) { return write_to_ogr("FlatGeobuf", dst); };
+
+    bool to_gpkg(fs::path dst, const HFAOGROptions &opts = HFAOGROptions()) {
+        return write_to_ogr("GPKG", dst, opts);
+    };
+
+    bool to_parquet(fs::path dst,
+                    const HFAOGROptions &opts = HFAOGROptions()) {
+        return write_to_ogr("Parquet", dst, opts);
     };
 
+    bool to_gjson(fs::path dst, bool seq = false, int precision = -1,
+                  bool sourceCRS = false);
+
     void printTree() { display_HFATree(root, 0); }
 
     friend ostream &operator<<(ostream &, const HFAAnnotationLayer &);
 };
 
+/************************************************************************/
+/*                                                                      */
+/*                           HFAMergeWriter                             */
+/*                                                                      */
+/*            Appends the annotations of many sources to one            */
+/*            shared HFAOGRWriter that stays open for the whole         */
+/*            run, every feature records the source it came from        */
+/*                                                                      */
+/************************************************************************/
+
+class HFAMergeWriter {
+    string format;
+    fs::path dst;
+    HFAOGROptions opts;
+
+    // taken from the first source, or the user
+    OGRSpatialReference srs;
+    bool hasSRS = false;
+    string srsWkt;
+
+    // created with the first source, NULL if that failed
+    unique_ptr<HFAOGRWriter> writer;
+    bool opened = false;
+
+    // sources are added from several worker threads
+    mutex lock;
+
+    bool open(HFAAnnotationLayer &layer);
+
+    bool write(HFAAnnotation &anno, const string &source);
+
+    friend class HFAMergeSource;
+
+  public:
+    HFAMergeWriter(const string &format, fs::path dst,
+                   const HFAOGROptions &opts)
+        : format(format), dst(dst), opts(opts) {}
+
+    HFAMergeWriter(const HFAMergeWriter &) = delete;
+
+    HFAMergeWriter &operator=(const HFAMergeWriter &) = delete;
+
+    bool add(HFAAnnotationLayer &layer, const string &source);
+
+    bool close();
+};
+
 /************************************************************************/
 /*                                                                      */
 /*                         HFA Geometry Factory                         */
@@ -370,18 +949,19 @@ class HFAAnnotationLayer {
  */
 class HFAGeomFactory {
   public:
-    typedef HFAGeom *(*Factory)(HFAEntry *);
+    typedef HFAGeom *(*Factory)(HFAEntry *, HFACoordStore &, HFAEantFields &);
 
     bool registerFactory(int gTypeId, string name, Factory const &factory) {
         return _map.insert(make_pair(gTypeId, factory)).second &&
                _idMap.insert(make_pair(gTypeId, name)).second;
     }
 
-    HFAGeom *build(int gTypeId, HFAEntry *node) {
+    HFAGeom *build(int gTypeId, HFAEntry *node, HFACoordStore &store,
+                   HFAEantFields &fields) {
         map<int, Factory>::const_iterator fIt = _map.find(gTypeId);
         if (fIt != _map.end()) {
             Factory f = fIt->second;
-            return (*f)(node);
+            return (*f)(node, store, fields);
         }
 
         return NULL;
@@ -403,8 +983,19 @@ class HFAGeomFactory {
     map<int, string> _idMap;
 };
 
-template <typename DerivedGeom> HFAGeom *geomBuilder(HFAEntry *node) {
-    return new DerivedGeom(node);
+// shapes without compiled fields (polylines)
+template <typename DerivedGeom>
+HFAGeom *geomBuilder(HFAEntry *node, HFACoordStore &store, HFAEantFields &) {
+    return new DerivedGeom(node, store);
+}
+
+// shapes constructed from their type's fields
+template <typename DerivedGeom, typename Fields,
+          HFATypeFields<Fields> HFAEantFields::*member>
+HFAGeom *geomBuilder(HFAEntry *node, HFACoordStore &store,
+                     HFAEantFields &fields) {
+    return new DerivedGeom(node, store, (fields.*member).of(node));
 }
 
-static HFAGeomFactory geomFactory;
+// shared by all translation units, shapes are registered in hfaclasses.cpp
+extern HFAGeomFactory geomFactory;